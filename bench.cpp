@@ -0,0 +1,456 @@
+// ========================================
+// 五子棋引擎微基准测试
+// 测量 ChessLogic / AILogic 热点函数的 ns/op、每次调用的内存分配次数，
+// 以及（内核允许 perf_event 时）每次调用的缓存未命中数
+//
+// 编译：g++ -std=c++17 -O2 -pthread bench.cpp -o gobang_bench
+// 运行：./gobang_bench                       打印结果
+//       ./gobang_bench --out before.tsv      同时把结果写成 TSV，供对比
+//       ./gobang_bench --compare before.tsv after.tsv
+//                                            对比两次构建的结果
+//       ./gobang_bench --filter think --min-time 500
+// ========================================
+#define GOBANG_NO_MAIN
+#include "server.cpp"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <new>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// ========================================
+// 内存分配计数 - 替换全局 operator new / delete
+// ========================================
+static atomic<long long> allocationCount{0};
+
+// 替换后的 new/delete 成对使用 malloc/free，GCC 内联后会误报不匹配
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void *operator new(size_t size)
+{
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+        throw bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+
+// ========================================
+// CacheMissCounter - perf_event 硬件计数器，不可用时 available() 为 false
+// ========================================
+class CacheMissCounter
+{
+private:
+    int fd;
+
+public:
+    CacheMissCounter() : fd(-1)
+    {
+#if defined(__linux__)
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+
+    ~CacheMissCounter()
+    {
+#if defined(__linux__)
+        if (fd >= 0)
+            close(fd);
+#endif
+    }
+
+    bool available() const
+    {
+        return fd >= 0;
+    }
+
+    void start()
+    {
+#if defined(__linux__)
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    long long stop()
+    {
+        long long value = 0;
+#if defined(__linux__)
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &value, sizeof(value)) != (ssize_t)sizeof(value))
+                value = 0;
+        }
+#endif
+        return value;
+    }
+};
+
+// 阻止编译器把被测调用的结果优化掉
+template <typename T>
+inline void keep(const T &value)
+{
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+// ========================================
+// 测试局面
+// ========================================
+struct Position
+{
+    string name;
+    vector<ChessPos> moves; // 按顺序落子，黑先
+};
+
+// server.log 里记录的一局（game_3，白棋五连获胜）
+static Position recordedGame()
+{
+    Position pos;
+    pos.name = "server.log game_3";
+    int moves[][2] = {{6, 6}, {5, 7}, {5, 6}, {4, 6}, {5, 5}, {3, 5}, {4, 4}, {2, 4}, {6, 8}, {1, 3}};
+    for (auto &m : moves)
+    {
+        pos.moves.push_back(ChessPos(m[0], m[1]));
+    }
+    return pos;
+}
+
+// 从天元开始，每步在已有棋子两格以内随机落子，跳过会直接成五的点，
+// 得到棋子成团、没有分出胜负的开局 / 中盘 / 残局局面
+static Position randomGame(const string &name, int stones, uint64_t seed)
+{
+    Position pos;
+    pos.name = name;
+    ChessLogic<13> chess;
+    Rng rng(seed);
+    int size = chess.getGradeSize();
+
+    chess.chessDown(size / 2, size / 2, CHESS_BLACK);
+    pos.moves.push_back(ChessPos(size / 2, size / 2));
+
+    int attempts = 0;
+    while ((int)pos.moves.size() < stones && attempts < 100000)
+    {
+        attempts++;
+        const ChessPos &anchor = pos.moves[rng.below((uint32_t)pos.moves.size())];
+        int row = anchor.row + (int)rng.below(5) - 2;
+        int col = anchor.col + (int)rng.below(5) - 2;
+        chess_kind side = chess.getSideToMove();
+        if (chess.getChessData(row, col) != 0 || row < 0 || row >= size || col < 0 || col >= size)
+            continue;
+        if (chess.isWinningMove(side, row, col))
+            continue;
+        chess.chessDown(row, col, side);
+        pos.moves.push_back(ChessPos(row, col));
+    }
+    return pos;
+}
+
+static vector<Position> buildCorpus()
+{
+    vector<Position> corpus;
+    corpus.push_back(recordedGame());
+    for (int i = 0; i < 6; i++)
+    {
+        corpus.push_back(randomGame("early-" + to_string(i), 10, 1000 + i));
+        corpus.push_back(randomGame("mid-" + to_string(i), 40, 2000 + i));
+        corpus.push_back(randomGame("late-" + to_string(i), 90, 3000 + i));
+    }
+    return corpus;
+}
+
+// 一个局面加载后的状态：棋盘、同步好评分表的 AI、以及一个空位（供落子测试）
+struct Loaded
+{
+    ChessLogic<13> chess;
+    AILogic<13> ai;
+    ChessPos emptyCell;
+
+    explicit Loaded(const Position &pos)
+    {
+        chess.init();
+        for (const ChessPos &move : pos.moves)
+        {
+            chess.chessDown(move.row, move.col, chess.getSideToMove());
+        }
+        ai.init(&chess);
+        ai.seed(1);
+        ai.calculateScore();
+
+        emptyCell = ChessPos(-1, -1);
+        int size = chess.getGradeSize();
+        for (int d = 0; d < size * size && emptyCell.row < 0; d++)
+        {
+            int row = (size / 2 + d / size) % size;
+            int col = (size / 2 + d) % size;
+            if (chess.getChessData(row, col) == 0)
+                emptyCell = ChessPos(row, col);
+        }
+    }
+
+    Loaded(const Loaded &) = delete;
+    Loaded &operator=(const Loaded &) = delete;
+};
+
+// ========================================
+// 计时
+// ========================================
+struct Result
+{
+    string name;
+    double nsPerOp;
+    double allocsPerOp;
+    double missesPerOp; // 小于 0 表示计数器不可用
+};
+
+// 一轮调用 iterations 次 op，依次轮换 count 个局面（不用取模，避免除法计入小函数的耗时）
+template <typename F>
+static void runRound(long long iterations, size_t count, F &op)
+{
+    size_t index = 0;
+    for (long long i = 0; i < iterations; i++)
+    {
+        op(index);
+        if (++index == count)
+            index = 0;
+    }
+}
+
+// 先标定循环次数使一轮至少跑 minTimeMs / 5，再跑 5 轮取中位数；
+// 分配次数和缓存未命中在单独的一轮里统计
+template <typename F>
+static Result measure(const string &name, int minTimeMs, size_t count, CacheMissCounter &misses, F &&op)
+{
+    using clock = chrono::steady_clock;
+    long long iterations = 1;
+    double roundNs = 0;
+    while (true)
+    {
+        auto start = clock::now();
+        runRound(iterations, count, op);
+        roundNs = (double)chrono::duration_cast<chrono::nanoseconds>(clock::now() - start).count();
+        if (roundNs >= minTimeMs * 1e6 / 5 || iterations >= (1LL << 40))
+            break;
+        iterations *= 2;
+    }
+
+    vector<double> samples;
+    for (int round = 0; round < 5; round++)
+    {
+        auto start = clock::now();
+        runRound(iterations, count, op);
+        samples.push_back((double)chrono::duration_cast<chrono::nanoseconds>(clock::now() - start).count() / iterations);
+    }
+    sort(samples.begin(), samples.end());
+
+    long long allocsBefore = allocationCount.load(memory_order_relaxed);
+    misses.start();
+    runRound(iterations, count, op);
+    long long missCount = misses.stop();
+    long long allocs = allocationCount.load(memory_order_relaxed) - allocsBefore;
+
+    Result result;
+    result.name = name;
+    result.nsPerOp = samples[2];
+    result.allocsPerOp = (double)allocs / iterations;
+    result.missesPerOp = misses.available() ? (double)missCount / iterations : -1;
+    return result;
+}
+
+// ========================================
+// 结果输出与对比
+// ========================================
+static void printResults(const vector<Result> &results)
+{
+    cout << left << setw(18) << "benchmark" << right << setw(14) << "ns/op" << setw(14) << "allocs/op"
+         << setw(16) << "cache-miss/op" << endl;
+    for (const Result &r : results)
+    {
+        cout << left << setw(18) << r.name << right << fixed << setprecision(1) << setw(14) << r.nsPerOp
+             << setprecision(2) << setw(14) << r.allocsPerOp;
+        if (r.missesPerOp >= 0)
+            cout << setw(16) << r.missesPerOp;
+        else
+            cout << setw(16) << "n/a";
+        cout << endl;
+    }
+}
+
+static void writeResults(const string &path, const vector<Result> &results)
+{
+    ofstream out(path);
+    for (const Result &r : results)
+    {
+        out << r.name << '\t' << r.nsPerOp << '\t' << r.allocsPerOp << '\t' << r.missesPerOp << '\n';
+    }
+}
+
+static bool readResults(const string &path, vector<Result> &results)
+{
+    ifstream in(path);
+    if (!in)
+        return false;
+    string line;
+    while (getline(in, line))
+    {
+        istringstream fields(line);
+        Result r;
+        if (fields >> r.name >> r.nsPerOp >> r.allocsPerOp >> r.missesPerOp)
+            results.push_back(r);
+    }
+    return true;
+}
+
+static int compareResults(const string &beforePath, const string &afterPath)
+{
+    vector<Result> before, after;
+    if (!readResults(beforePath, before) || !readResults(afterPath, after))
+    {
+        cerr << "错误：无法读取 " << beforePath << " 或 " << afterPath << endl;
+        return 1;
+    }
+
+    cout << left << setw(18) << "benchmark" << right << setw(14) << "before ns" << setw(14) << "after ns"
+         << setw(10) << "change" << setw(16) << "allocs b->a" << endl;
+    for (const Result &b : before)
+    {
+        for (const Result &a : after)
+        {
+            if (a.name != b.name)
+                continue;
+            double change = b.nsPerOp > 0 ? (a.nsPerOp - b.nsPerOp) / b.nsPerOp * 100 : 0;
+            ostringstream allocs;
+            allocs << fixed << setprecision(1) << b.allocsPerOp << "->" << a.allocsPerOp;
+            cout << left << setw(18) << b.name << right << fixed << setprecision(1) << setw(14) << b.nsPerOp
+                 << setw(14) << a.nsPerOp << setw(9) << showpos << change << noshowpos << "%" << setw(16)
+                 << allocs.str() << endl;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    string outPath;
+    string filter;
+    int minTimeMs = 300;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--compare" && i + 2 < argc)
+            return compareResults(argv[i + 1], argv[i + 2]);
+        if (arg == "--out" && i + 1 < argc)
+            outPath = argv[++i];
+        else if (arg == "--filter" && i + 1 < argc)
+            filter = argv[++i];
+        else if (arg == "--min-time" && i + 1 < argc)
+            minTimeMs = max(10, atoi(argv[++i]));
+        else
+        {
+            cerr << "用法: " << argv[0] << " [--out file.tsv] [--filter name] [--min-time ms]" << endl;
+            cerr << "      " << argv[0] << " --compare before.tsv after.tsv" << endl;
+            return 1;
+        }
+    }
+
+    ScoreKernel::Kind kernel = ScoreKernel::select(getenv("GOBANG_SCORE_KERNEL"));
+    vector<Position> corpus = buildCorpus();
+    vector<unique_ptr<Loaded>> positions;
+    for (const Position &pos : corpus)
+    {
+        positions.push_back(make_unique<Loaded>(pos));
+    }
+    size_t count = positions.size();
+
+    CacheMissCounter misses;
+    cout << "评分内核: " << ScoreKernel::name(kernel) << ", 局面数: " << count
+         << ", 缓存计数器: " << (misses.available() ? "perf_event" : "不可用") << endl;
+
+    vector<Result> results;
+    auto run = [&](const string &name, auto &&op)
+    {
+        if (!filter.empty() && name.find(filter) == string::npos)
+            return;
+        results.push_back(measure(name, minTimeMs, count, misses, op));
+    };
+
+    // 落子后立即悔棋，局面保持不变
+    run("chessDown+undo", [&](size_t i)
+        {
+        Loaded &p = *positions[i];
+        keep(p.chess.chessDown(p.emptyCell.row, p.emptyCell.col, p.chess.getSideToMove()));
+        p.chess.undo(); });
+
+    run("checkWin", [&](size_t i)
+        {
+        Loaded &p = *positions[i];
+        keep(p.chess.checkWin()); });
+
+    run("getBoard", [&](size_t i)
+        {
+        Loaded &p = *positions[i];
+        vector<vector<int>> board = p.chess.getBoard();
+        keep(board); });
+
+    run("calculateScore", [&](size_t i)
+        {
+        Loaded &p = *positions[i];
+        p.ai.calculateScore();
+        keep(p.ai); });
+
+    // 评分表已同步，think() 只做增量检查和选点，与服务器每步的开销一致
+    run("think", [&](size_t i)
+        {
+        Loaded &p = *positions[i];
+        keep(p.ai.think()); });
+
+    printResults(results);
+    if (!outPath.empty())
+        writeResults(outPath, results);
+    return 0;
+}
@@ -2,7 +2,12 @@
 // 服务器配置
 // ==========================================
 const SERVER_URL = 'http://123.56.77.88:8888';
-console.log('游戏初始化, 服务器地址:', SERVER_URL);
+// WebSocket 对局通道：连得上就用它走棋，连不上或断线时退回 HTTP 接口
+const WS_URL = 'ws://123.56.77.88:8889/ws/game';
+// 轮询 /api/move-result 的间隔，以及最多等多久就放弃
+const MOVE_RESULT_POLL_MS = 100;
+const MOVE_RESULT_TIMEOUT_MS = 60000;
+console.log('游戏初始化, 服务器地址:', SERVER_URL, WS_URL);
 
 // ==========================================
 // ChessPos 结构体
@@ -221,6 +226,9 @@ class OnlineGobangGame {
         this.chess = new Chess(13, 44, 43, 67.3);
         this.gameStarted = false;
         this.aiThinking = false;
+        this.moveSeq = 0;
+        this.socket = null;         // 已打开的 WebSocket，为 null 时走 HTTP
+        this.pendingGame = null;    // 等待 new-game 回复的 resolve
 
         console.log('OnlineGobangGame 初始化');
         this.init();
@@ -231,6 +239,99 @@ class OnlineGobangGame {
         this.chess.init();
         this.setupEventListeners();
         this.checkServerConnection();
+        this.connectSocket();
+    }
+
+    // 建立 WebSocket 连接；浏览器不支持或 2 秒内连不上就继续用 HTTP
+    connectSocket() {
+        if (typeof WebSocket === 'undefined') {
+            return;
+        }
+        let socket;
+        try {
+            socket = new WebSocket(WS_URL);
+        } catch (error) {
+            console.warn('WebSocket 创建失败，使用 HTTP:', error);
+            return;
+        }
+        const timer = setTimeout(() => socket.close(), 2000);
+
+        socket.onopen = () => {
+            clearTimeout(timer);
+            console.log('✅ WebSocket 已连接');
+            this.socket = socket;
+            // 已经用 HTTP 开了局的话，把这一局绑定到连接上
+            if (this.gameId) {
+                socket.send(JSON.stringify({ type: 'join', gameId: this.gameId }));
+            }
+        };
+        socket.onmessage = (event) => this.handleSocketMessage(JSON.parse(event.data));
+        socket.onclose = () => {
+            clearTimeout(timer);
+            if (this.socket === socket) {
+                console.warn('WebSocket 已断开，改用 HTTP');
+                this.socket = null;
+                this.aiThinking = false;
+            }
+            if (this.pendingGame) {
+                this.pendingGame.resolve(null);
+                this.pendingGame = null;
+            }
+        };
+    }
+
+    handleSocketMessage(data) {
+        console.log('WebSocket 消息:', data);
+        switch (data.type) {
+            case 'game':
+                if (this.pendingGame) {
+                    this.pendingGame.resolve(data);
+                    this.pendingGame = null;
+                }
+                break;
+            case 'moved':
+                // 服务器确认了玩家这一步，AI 的应手随后单独推送
+                this.chess.chessDown(new ChessPos(data.row, data.col), chess_kind.CHESS_BLACK);
+                if (data.gameOver) {
+                    this.aiThinking = false;
+                    this.finishGame(data.winner, true);
+                } else {
+                    this.showAiThinking();
+                }
+                break;
+            case 'aiMove':
+                // row 为 null：棋盘已满，AI 无处可下
+                if (data.row === null) {
+                    this.aiThinking = false;
+                    this.gameStarted = false;
+                    this.showResult('平局！');
+                    break;
+                }
+                this.showAiMove(data, data.gameOver ? data.winner : null);
+                break;
+            case 'error':
+                console.error('服务器返回错误:', data.error);
+                // 开局请求失败：交给 newGame() 的 catch 提示
+                if (this.pendingGame) {
+                    this.pendingGame.reject(new Error(data.message || data.error));
+                    this.pendingGame = null;
+                    break;
+                }
+                this.aiThinking = false;
+                alert(data.error);
+                break;
+        }
+    }
+
+    // 通过 WebSocket 开局；连接不可用时返回 null，由调用方改走 HTTP；服务器回 error 时 reject
+    requestGameOverSocket() {
+        if (!this.socket || this.socket.readyState !== WebSocket.OPEN) {
+            return Promise.resolve(null);
+        }
+        return new Promise((resolve, reject) => {
+            this.pendingGame = { resolve, reject };
+            this.socket.send(JSON.stringify({ type: 'new-game' }));
+        });
     }
 
     // 检查服务器连接
@@ -307,19 +408,23 @@ class OnlineGobangGame {
         console.log('=== 开始新游戏 ===');
         try {
             console.log('发送新游戏请求...');
-            const response = await fetch(`${SERVER_URL}/api/new-game`, {
-                method: 'POST',
-                headers: { 'Content-Type': 'application/json' }
-            });
+            let data = await this.requestGameOverSocket();
+            if (!data) {
+                const response = await fetch(`${SERVER_URL}/api/new-game`, {
+                    method: 'POST',
+                    headers: { 'Content-Type': 'application/json' }
+                });
 
-            console.log('新游戏响应:', response);
+                console.log('新游戏响应:', response);
 
-            const data = await response.json();
+                data = await response.json();
+            }
             console.log('新游戏数据:', data);
 
             this.gameId = data.gameId;
             this.gameStarted = true;
             this.aiThinking = false;
+            this.moveSeq = 0;
 
             this.chess.init();
             document.getElementById('game-status').textContent = '游戏开始！请落子';
@@ -366,11 +471,25 @@ class OnlineGobangGame {
 
         document.getElementById('game-status').textContent = '正在发送落子请求...';
 
+        // WebSocket 可用时只发坐标和 moveId，结果由 handleSocketMessage 处理
+        if (this.socket && this.socket.readyState === WebSocket.OPEN) {
+            this.aiThinking = true;
+            this.socket.send(JSON.stringify({
+                type: 'move',
+                row: row,
+                col: col,
+                moveId: `${this.gameId}:${this.moveSeq++}`
+            }));
+            return;
+        }
+
         try {
+            // moveId 用于服务器端去重，网络重试时不会被重复执行
             const requestBody = {
                 gameId: this.gameId,
                 row: row,
-                col: col
+                col: col,
+                moveId: `${this.gameId}:${this.moveSeq++}`
             };
             console.log('请求体:', requestBody);
 
@@ -382,7 +501,7 @@ class OnlineGobangGame {
 
             console.log('落子响应:', response);
 
-            const data = await response.json();
+            let data = await response.json();
             console.log('落子数据:', data);
 
             if (data.error) {
@@ -395,40 +514,26 @@ class OnlineGobangGame {
             this.chess.chessDown(new ChessPos(row, col), chess_kind.CHESS_BLACK);
             console.log('✅ 玩家落子完成');
 
-            if (data.gameOver) {
-                console.log('游戏结束, 获胜方:', data.winner);
-                this.gameStarted = false;
-                const winner = data.winner === 'black' ? '黑棋（玩家）' : '白棋（AI）';
-                this.showResult(`🎉 ${winner}获胜！`);
+            // AI 还没算完：服务器给了 ticket，凭它取回 AI 的应手
+            if (data.pending) {
+                this.showAiThinking();
+                data = await this.waitMoveResult(data.ticket);
+                if (data.error) {
+                    this.aiThinking = false;
+                    alert(data.error);
+                    return;
+                }
+            }
+
+            if (data.gameOver && !data.aiMove) {
+                this.finishGame(data.winner, true);
                 return;
             }
 
             // AI落子
             if (data.aiMove) {
-                this.aiThinking = true;
-                document.getElementById('game-status').textContent = 'AI正在思考...';
-                document.getElementById('current-turn').innerHTML = '当前：<strong>白棋（AI）</strong>';
-
-                console.log('AI将在0.8秒后落子:', data.aiMove);
-
-                setTimeout(() => {
-                    this.chess.chessDown(
-                        new ChessPos(data.aiMove.row, data.aiMove.col),
-                        chess_kind.CHESS_WHITE
-                    );
-                    console.log('✅ AI落子完成');
-
-                    this.aiThinking = false;
-                    document.getElementById('game-status').textContent = 'AI已落子';
-                    document.getElementById('current-turn').innerHTML = '当前：<strong>黑棋（玩家）</strong>';
-
-                    if (data.gameOver) {
-                        console.log('游戏结束, 获胜方:', data.winner);
-                        this.gameStarted = false;
-                        const winner = data.winner === 'black' ? '黑棋（玩家）' : '白棋（AI）';
-                        this.showResult(`${winner}获胜！`);
-                    }
-                }, 800);
+                this.showAiThinking();
+                this.showAiMove(data.aiMove, data.gameOver ? data.winner : null);
             }
 
         } catch (error) {
@@ -437,6 +542,55 @@ class OnlineGobangGame {
         }
     }
 
+    // 轮询 /api/move-result，服务器每次最多等一会儿，还没算完就返回 pending；
+    // 两次轮询之间稍作停顿，超过 MOVE_RESULT_TIMEOUT_MS 仍没有结果就放弃
+    async waitMoveResult(ticket) {
+        const deadline = Date.now() + MOVE_RESULT_TIMEOUT_MS;
+        while (true) {
+            const response = await fetch(`${SERVER_URL}/api/move-result/${this.gameId}?ticket=${ticket}`);
+            const data = await response.json();
+            console.log('AI 结果:', data);
+            if (!data.pending) {
+                return data;
+            }
+            if (Date.now() >= deadline) {
+                return { error: 'AI 应手超时，请重新开始' };
+            }
+            await new Promise((resolve) => setTimeout(resolve, MOVE_RESULT_POLL_MS));
+        }
+    }
+
+    showAiThinking() {
+        this.aiThinking = true;
+        document.getElementById('game-status').textContent = 'AI正在思考...';
+        document.getElementById('current-turn').innerHTML = '当前：<strong>白棋（AI）</strong>';
+    }
+
+    // 画出 AI 的应手；winner 不为 null 时随后显示结果
+    showAiMove(aiMove, winner) {
+        console.log('AI将在0.8秒后落子:', aiMove);
+
+        setTimeout(() => {
+            this.chess.chessDown(new ChessPos(aiMove.row, aiMove.col), chess_kind.CHESS_WHITE);
+            console.log('✅ AI落子完成');
+
+            this.aiThinking = false;
+            document.getElementById('game-status').textContent = 'AI已落子';
+            document.getElementById('current-turn').innerHTML = '当前：<strong>黑棋（玩家）</strong>';
+
+            if (winner) {
+                this.finishGame(winner, false);
+            }
+        }, 800);
+    }
+
+    finishGame(winner, playerMove) {
+        console.log('游戏结束, 获胜方:', winner);
+        this.gameStarted = false;
+        const name = winner === 'black' ? '黑棋（玩家）' : '白棋（AI）';
+        this.showResult(playerMove ? `🎉 ${name}获胜！` : `${name}获胜！`);
+    }
+
     showResult(text) {
         console.log('显示结果:', text);
         document.getElementById('result-title').textContent = text;
@@ -0,0 +1,387 @@
+// ========================================
+// 五子棋服务器压测工具
+// 模拟 N 个玩家，各自用一条 keep-alive 连接走完整的对局流程：
+//   /api/new-game -> 反复 /api/move（每步之间按思考时间停顿；返回 pending 时轮询 /api/move-result）-> 定期 /api/board
+// 结束后按接口输出吞吐量、p50/p99/p999 延迟、错误率，以及服务器每个请求消耗的 CPU 时间
+//
+// 编译：g++ -std=c++17 -O2 -pthread loadgen.cpp -o gobang_loadgen
+// 运行：./gobang_loadgen --players 200 --duration 30 --think-ms 300 --server-pid $(pidof gobang_server)
+// ========================================
+#include "httplib.h"
+#include "json.hpp"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <unistd.h>
+
+using namespace std;
+using json = nlohmann::json;
+
+struct Options
+{
+    string host = "127.0.0.1";
+    int port = 8888;
+    int players = 50;
+    int durationSeconds = 20;
+    int thinkMs = 300;      // 玩家每步的平均思考时间，实际在 0.5~1.5 倍之间随机
+    int boardEvery = 3;     // 每走几步查询一次 /api/board
+    string difficulty = "easy";
+    int gradeSize = 13;
+    int serverPid = 0;      // 大于 0 时从 /proc 读取服务器进程的 CPU 时间
+};
+
+enum Route
+{
+    ROUTE_NEW_GAME,
+    ROUTE_MOVE,
+    ROUTE_BOARD,
+    ROUTE_MOVE_RESULT,
+    ROUTE_COUNT
+};
+
+static const char *routeName(int route)
+{
+    static const char *names[] = {"/api/new-game", "/api/move", "/api/board", "/api/move-result"};
+    return names[route];
+}
+
+// 每个玩家线程各自记录，结束后合并，记录过程不需要加锁
+struct Stats
+{
+    vector<uint32_t> latencyMicros[ROUTE_COUNT];
+    long long errors[ROUTE_COUNT] = {};
+    long long games = 0;
+    long long finishedGames = 0;
+};
+
+static atomic<bool> running{true};
+
+// 读取 /proc/<pid>/stat 中的 utime + stime（单位：时钟滴答）
+static long long processCpuTicks(int pid)
+{
+    ifstream in("/proc/" + to_string(pid) + "/stat");
+    string content;
+    if (!getline(in, content))
+        return -1;
+    // 第 2 个字段（进程名）可能含空格，从最后一个 ')' 之后开始数
+    size_t close = content.rfind(')');
+    if (close == string::npos)
+        return -1;
+    istringstream fields(content.substr(close + 2));
+    string field;
+    long long utime = 0, stime = 0;
+    for (int i = 3; i <= 15 && fields >> field; i++)
+    {
+        if (i == 14)
+            utime = atoll(field.c_str());
+        else if (i == 15)
+            stime = atoll(field.c_str());
+    }
+    return utime + stime;
+}
+
+class Player
+{
+private:
+    static const int RESULT_POLL_MS = 50; // 查询 /api/move-result 的平均间隔
+
+    const Options &options;
+    Stats &stats;
+    httplib::Client client;
+    mt19937 rng;
+    vector<vector<int>> board;
+    string gameId;
+    int moveSeq;
+
+    // 发一次请求并计时；连接失败、非 200 或返回 error 字段都计为错误
+    bool call(Route route, const string &method, const string &path, const string &body, json &result)
+    {
+        auto start = chrono::steady_clock::now();
+        httplib::Result res = method == "GET" ? client.Get(path)
+                                              : client.Post(path, body, "application/json");
+        auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+        stats.latencyMicros[route].push_back((uint32_t)min<long long>(elapsed, UINT32_MAX));
+
+        if (!res || res->status != 200)
+        {
+            stats.errors[route]++;
+            return false;
+        }
+        result = json::parse(res->body, nullptr, false);
+        if (result.is_discarded() || result.contains("error"))
+        {
+            stats.errors[route]++;
+            return false;
+        }
+        return true;
+    }
+
+    void pause(int meanMs)
+    {
+        if (meanMs <= 0)
+            return;
+        uniform_int_distribution<int> jitter(meanMs / 2, meanMs * 3 / 2);
+        auto until = chrono::steady_clock::now() + chrono::milliseconds(jitter(rng));
+        while (running && chrono::steady_clock::now() < until)
+        {
+            this_thread::sleep_for(chrono::milliseconds(min(50, meanMs)));
+        }
+    }
+
+    bool newGame()
+    {
+        json request = {{"difficulty", options.difficulty}, {"gradeSize", options.gradeSize}};
+        json result;
+        if (!call(ROUTE_NEW_GAME, "POST", "/api/new-game", request.dump(), result))
+            return false;
+        gameId = result.value("gameId", "");
+        board.assign(options.gradeSize, vector<int>(options.gradeSize, 0));
+        moveSeq = 0;
+        stats.games++;
+        return !gameId.empty();
+    }
+
+    // 像真人一样落在已有棋子附近；开局下天元
+    bool pickMove(int &row, int &col)
+    {
+        int size = options.gradeSize;
+        vector<pair<int, int>> candidates;
+        for (int r = 0; r < size; r++)
+        {
+            for (int c = 0; c < size; c++)
+            {
+                if (board[r][c] != 0)
+                    continue;
+                bool near = false;
+                for (int dr = -2; dr <= 2 && !near; dr++)
+                {
+                    for (int dc = -2; dc <= 2 && !near; dc++)
+                    {
+                        int rr = r + dr, cc = c + dc;
+                        near = rr >= 0 && rr < size && cc >= 0 && cc < size && board[rr][cc] != 0;
+                    }
+                }
+                if (near)
+                    candidates.push_back(make_pair(r, c));
+            }
+        }
+        if (candidates.empty())
+        {
+            if (board[size / 2][size / 2] != 0)
+                return false;
+            row = col = size / 2;
+            return true;
+        }
+        auto pick = candidates[uniform_int_distribution<size_t>(0, candidates.size() - 1)(rng)];
+        row = pick.first;
+        col = pick.second;
+        return true;
+    }
+
+    // 走完一局；返回 false 表示出错，需要重开
+    bool playGame()
+    {
+        if (!newGame())
+            return false;
+
+        int moves = 0;
+        while (running)
+        {
+            pause(options.thinkMs);
+            if (!running)
+                break;
+
+            int row, col;
+            if (!pickMove(row, col))
+                return true;
+
+            json request = {{"gameId", gameId}, {"row", row}, {"col", col},
+                            {"moveId", gameId + ":" + to_string(moveSeq++)}};
+            json result;
+            if (!call(ROUTE_MOVE, "POST", "/api/move", request.dump(), result))
+                return false;
+            // AI 没在服务器的等待时间内算完时，凭 ticket 取回应手；服务器端的等待时间调得很短时，
+            // 两次查询之间也要停一下，免得每个玩家变成一个空转的请求循环，拉高 req/s、拉低 p50
+            while (result.value("pending", false))
+            {
+                pause(RESULT_POLL_MS);
+                if (!running)
+                    return true;
+                string path = "/api/move-result/" + gameId + "?ticket=" + to_string(result.value("ticket", 0));
+                if (!call(ROUTE_MOVE_RESULT, "GET", path, "", result))
+                    return false;
+            }
+            board[row][col] = 1;
+            if (result.contains("aiMove"))
+            {
+                board[result["aiMove"]["row"].get<int>()][result["aiMove"]["col"].get<int>()] = -1;
+            }
+
+            moves++;
+            if (options.boardEvery > 0 && moves % options.boardEvery == 0)
+            {
+                json boardResult;
+                call(ROUTE_BOARD, "GET", "/api/board/" + gameId, "", boardResult);
+            }
+            if (result.value("gameOver", false))
+            {
+                stats.finishedGames++;
+                return true;
+            }
+        }
+        return true;
+    }
+
+public:
+    Player(const Options &options, Stats &stats, unsigned seed)
+        : options(options), stats(stats), client(options.host, options.port), rng(seed), moveSeq(0)
+    {
+        client.set_keep_alive(true);
+        client.set_tcp_nodelay(true);
+        client.set_connection_timeout(5);
+        client.set_read_timeout(30);
+    }
+
+    void run()
+    {
+        while (running)
+        {
+            if (!playGame())
+                pause(100); // 出错后稍等再重开，避免空转
+        }
+    }
+};
+
+static double percentile(const vector<uint32_t> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t index = (size_t)min<double>(sorted.size() - 1, p * sorted.size());
+    return sorted[index] / 1000.0;
+}
+
+static bool parseOptions(int argc, char **argv, Options &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (i + 1 >= argc)
+            return false;
+        string value = argv[++i];
+        if (arg == "--host")
+            options.host = value;
+        else if (arg == "--port")
+            options.port = atoi(value.c_str());
+        else if (arg == "--players")
+            options.players = max(1, atoi(value.c_str()));
+        else if (arg == "--duration")
+            options.durationSeconds = max(1, atoi(value.c_str()));
+        else if (arg == "--think-ms")
+            options.thinkMs = max(0, atoi(value.c_str()));
+        else if (arg == "--board-every")
+            options.boardEvery = max(0, atoi(value.c_str()));
+        else if (arg == "--difficulty")
+            options.difficulty = value;
+        else if (arg == "--grade-size")
+            options.gradeSize = atoi(value.c_str());
+        else if (arg == "--server-pid")
+            options.serverPid = atoi(value.c_str());
+        else
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        cerr << "用法: " << argv[0] << " [--host 127.0.0.1] [--port 8888] [--players 50] [--duration 20]" << endl;
+        cerr << "       [--think-ms 300] [--board-every 3] [--difficulty easy] [--grade-size 13] [--server-pid PID]" << endl;
+        return 1;
+    }
+
+    cout << "压测: " << options.players << " 个玩家, " << options.durationSeconds << " 秒, 思考 "
+         << options.thinkMs << "ms, 难度 " << options.difficulty << ", 目标 " << options.host << ":" << options.port
+         << endl;
+
+    long long ticksBefore = options.serverPid > 0 ? processCpuTicks(options.serverPid) : -1;
+    auto start = chrono::steady_clock::now();
+
+    vector<Stats> stats(options.players);
+    vector<thread> threads;
+    for (int i = 0; i < options.players; i++)
+    {
+        threads.emplace_back([&options, &stats, i]()
+                             {
+            Player player(options, stats[i], 12345u + i);
+            player.run(); });
+    }
+
+    this_thread::sleep_for(chrono::seconds(options.durationSeconds));
+    running = false;
+    for (thread &t : threads)
+    {
+        t.join();
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    long long ticksAfter = options.serverPid > 0 ? processCpuTicks(options.serverPid) : -1;
+
+    // 合并各线程的数据
+    Stats total;
+    for (Stats &s : stats)
+    {
+        for (int r = 0; r < ROUTE_COUNT; r++)
+        {
+            total.latencyMicros[r].insert(total.latencyMicros[r].end(), s.latencyMicros[r].begin(), s.latencyMicros[r].end());
+            total.errors[r] += s.errors[r];
+        }
+        total.games += s.games;
+        total.finishedGames += s.finishedGames;
+    }
+
+    long long requests = 0;
+    cout << endl
+         << left << setw(16) << "route" << right << setw(10) << "requests" << setw(10) << "req/s" << setw(10)
+         << "errors" << setw(12) << "p50 ms" << setw(12) << "p99 ms" << setw(12) << "p999 ms" << endl;
+    for (int r = 0; r < ROUTE_COUNT; r++)
+    {
+        vector<uint32_t> &latency = total.latencyMicros[r];
+        sort(latency.begin(), latency.end());
+        requests += (long long)latency.size();
+        double errorRate = latency.empty() ? 0 : 100.0 * total.errors[r] / latency.size();
+        ostringstream errors;
+        errors << fixed << setprecision(2) << errorRate << "%";
+        cout << left << setw(16) << routeName(r) << right << setw(10) << latency.size() << setw(10) << fixed
+             << setprecision(1) << latency.size() / seconds << setw(10) << errors.str() << setprecision(2)
+             << setw(12) << percentile(latency, 0.50) << setw(12) << percentile(latency, 0.99) << setw(12)
+             << percentile(latency, 0.999) << endl;
+    }
+
+    cout << endl
+         << "总计: " << requests << " 个请求, " << fixed << setprecision(1) << requests / seconds << " req/s, "
+         << total.games << " 局（" << total.finishedGames << " 局分出胜负）" << endl;
+
+    if (ticksBefore >= 0 && ticksAfter >= 0 && requests > 0)
+    {
+        double cpuMs = (ticksAfter - ticksBefore) * 1000.0 / sysconf(_SC_CLK_TCK);
+        cout << "服务器 CPU: " << setprecision(1) << cpuMs << " ms, 平均每个请求 " << setprecision(3)
+             << cpuMs / requests << " ms, 平均占用 " << setprecision(1) << cpuMs / 10.0 / seconds << "% 核" << endl;
+    }
+    else if (options.serverPid > 0)
+    {
+        cout << "无法读取 /proc/" << options.serverPid << "/stat，跳过 CPU 统计" << endl;
+    }
+    return 0;
+}
@@ -6,13 +6,44 @@
 #include "httplib.h"
 #include "json.hpp"
 #include <iostream>
+#include <fstream>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <deque>
+#include <array>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
 #include <memory>
 #include <cmath>
 #include <cstdlib>
 #include <ctime>
+#include <cstdint>
+#include <cstring>
+#include <csignal>
+#include <algorithm>
+#include <charconv>
+#include <cerrno>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 using json = nlohmann::json;
 using namespace std;
@@ -33,51 +64,206 @@ enum chess_kind
     CHESS_BLACK = 1
 };
 
+// ========================================
+// BitBoard - 棋盘的位平面表示
+// 每种颜色各一组位平面：行、列、两条斜线方向各一份，
+// 一条线上的棋子压缩在一个 uint32_t 里，整块数据内联在对象中，不做堆分配
+// ========================================
+const int MAX_GRADE_SIZE = 19;
+const int MAX_DIAG_COUNT = 2 * MAX_GRADE_SIZE - 1;
+
+struct BitBoard
+{
+    uint32_t rows[2][MAX_GRADE_SIZE];       // rows[c][row] 的第 col 位
+    uint32_t cols[2][MAX_GRADE_SIZE];       // cols[c][col] 的第 row 位
+    uint32_t diags[2][MAX_DIAG_COUNT];      // 右斜 (\)：下标 row - col + size - 1，第 col 位
+    uint32_t antiDiags[2][MAX_DIAG_COUNT];  // 左斜 (/)：下标 row + col，第 col 位
+
+    void clear()
+    {
+        memset(this, 0, sizeof(*this));
+    }
+
+    void set(int c, int row, int col, int size)
+    {
+        rows[c][row] |= 1u << col;
+        cols[c][col] |= 1u << row;
+        diags[c][row - col + size - 1] |= 1u << col;
+        antiDiags[c][row + col] |= 1u << col;
+    }
+
+    void reset(int c, int row, int col, int size)
+    {
+        rows[c][row] &= ~(1u << col);
+        cols[c][col] &= ~(1u << row);
+        diags[c][row - col + size - 1] &= ~(1u << col);
+        antiDiags[c][row + col] &= ~(1u << col);
+    }
+
+    bool test(int c, int row, int col) const
+    {
+        return (rows[c][row] >> col) & 1u;
+    }
+};
+
+// ========================================
+// Zobrist 键 - 每个 (颜色, 格子) 一个随机 64 位数，局面键为所有棋子的异或
+// 固定种子生成，所有对局共用同一张表，置换表才能跨对局复用
+// ========================================
+struct ZobristKeys
+{
+    uint64_t stones[2][MAX_GRADE_SIZE * MAX_GRADE_SIZE];
+    uint64_t sizeSalt[MAX_GRADE_SIZE + 1]; // 区分不同边长的棋盘
+
+    ZobristKeys()
+    {
+        uint64_t state = 0x9E3779B97F4A7C15ULL;
+        for (int c = 0; c < 2; c++)
+        {
+            for (int i = 0; i < MAX_GRADE_SIZE * MAX_GRADE_SIZE; i++)
+            {
+                stones[c][i] = next(state);
+            }
+        }
+        for (int i = 0; i <= MAX_GRADE_SIZE; i++)
+        {
+            sizeSalt[i] = next(state);
+        }
+    }
+
+    // splitmix64
+    static uint64_t next(uint64_t &state)
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    static const ZobristKeys &instance()
+    {
+        static const ZobristKeys keys;
+        return keys;
+    }
+
+    uint64_t stone(int c, int row, int col) const
+    {
+        return stones[c][row * MAX_GRADE_SIZE + col];
+    }
+};
+
+// ========================================
+// Rng - xoshiro256**，每个 AI 各持一个，代替全局加锁的 rand()
+// 用 64 位种子经 splitmix64 展开成 256 位状态，同一种子得到同一序列，便于复盘
+// ========================================
+class Rng
+{
+private:
+    uint64_t s[4];
+
+    static uint64_t rotl(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+public:
+    explicit Rng(uint64_t seed = 0)
+    {
+        this->seed(seed);
+    }
+
+    void seed(uint64_t seed)
+    {
+        uint64_t state = seed;
+        for (int i = 0; i < 4; i++)
+        {
+            s[i] = ZobristKeys::next(state);
+        }
+    }
+
+    uint64_t next()
+    {
+        uint64_t result = rotl(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    // [0, n) 内的均匀整数（乘法取高位，代替取模）
+    uint32_t below(uint32_t n)
+    {
+        return (uint32_t)(((next() >> 32) * n) >> 32);
+    }
+};
+
+// 棋子颜色 -> 位平面下标（黑 0，白 1）
+inline int colorIndex(int kind)
+{
+    return kind == CHESS_BLACK ? 0 : 1;
+}
+
 // ========================================
 // ChessLogic 类 - 从你的 Chess.cpp 改编
 // 移除了所有 EasyX 相关代码，保留核心逻辑
+// 棋盘边长 N 是模板参数（13 / 15 / 19），所有状态都是定长数组，对象本身不再分配内存
 // ========================================
+template <int N>
 class ChessLogic
 {
+    static_assert(N >= 5 && N <= MAX_GRADE_SIZE, "gradeSize out of range");
+
 private:
-    int gradeSize;
-    int margin_x;
-    int margin_y;
-    float chessSize;
-    vector<vector<int>> chessMap;
+    static constexpr int gradeSize = N;
+    BitBoard board;
     bool playerFlag; // true=黑棋, false=白棋
     ChessPos lastPos;
+    array<ChessPos, N * N> moveHistory; // 按顺序记录的落子
+    int moveCount;
+    int version; // 每次 init() 递增，供 AI 判断增量状态是否失效
+    uint64_t hashKey; // 当前局面的 Zobrist 键，落子/悔棋时增量更新
 
-public:
-    // 对应 Chess::Chess()
-    ChessLogic(int gradeSize = 13, int marginX = 44, int marginY = 43, float chessSize = 67.3f)
-        : gradeSize(gradeSize), margin_x(marginX), margin_y(marginY),
-          chessSize(chessSize), playerFlag(true), lastPos(-1, -1)
+    // 一条线上是否有经过 pos 的五连：只保留 [pos-4, pos+4] 这 9 位，
+    // 窗口内任何连续 5 位都必然覆盖 pos，移位相与即可判断，不需要逐格数子
+    static bool fiveAt(uint32_t line, int pos)
     {
+        uint32_t m = line & (pos >= 4 ? 0x1FFu << (pos - 4) : 0x1FFu >> (4 - pos));
+        return (m & (m >> 1) & (m >> 2) & (m >> 3) & (m >> 4)) != 0;
+    }
 
-        for (int i = 0; i < gradeSize; i++)
-        {
-            vector<int> row;
-            for (int j = 0; j < gradeSize; j++)
-            {
-                row.push_back(0);
-            }
-            chessMap.push_back(row);
-        }
+    // 把 (row, col) 视为 c 方棋子后，经过它的四条线上是否有五连
+    bool fiveThrough(int c, int row, int col) const
+    {
+        uint32_t rowBit = 1u << row;
+        uint32_t colBit = 1u << col;
+        return fiveAt(board.rows[c][row] | colBit, col) ||
+               fiveAt(board.cols[c][col] | rowBit, row) ||
+               fiveAt(board.diags[c][row - col + gradeSize - 1] | colBit, col) ||
+               fiveAt(board.antiDiags[c][row + col] | colBit, col);
+    }
+
+public:
+    // 对应 Chess::Chess() - 桌面版的 margin_x / margin_y / chessSize 只用于绘制，已去掉
+    ChessLogic()
+        : playerFlag(true), lastPos(-1, -1), moveCount(0), version(0)
+    {
+        board.clear();
+        hashKey = ZobristKeys::instance().sizeSalt[gradeSize];
     }
 
     // 对应 Chess::init()
     void init()
     {
-        for (int i = 0; i < gradeSize; i++)
-        {
-            for (int j = 0; j < gradeSize; j++)
-            {
-                chessMap[i][j] = 0;
-            }
-        }
+        board.clear();
         playerFlag = true;
         lastPos = ChessPos(-1, -1);
+        moveCount = 0;
+        version++;
+        hashKey = ZobristKeys::instance().sizeSalt[gradeSize];
     }
 
     // 对应 Chess::chessDown() - 简化版（无图形）
@@ -87,7 +273,7 @@ public:
         {
             return false;
         }
-        if (chessMap[row][col] != 0)
+        if (board.test(0, row, col) || board.test(1, row, col))
         {
             return false;
         }
@@ -100,13 +286,37 @@ public:
     // 对应 Chess::updateGameMap()
     void updateGameMap(ChessPos *pos)
     {
-        chessMap[pos->row][pos->col] = playerFlag ? CHESS_BLACK : CHESS_WHITE;
+        int c = colorIndex(playerFlag ? CHESS_BLACK : CHESS_WHITE);
+        board.set(c, pos->row, pos->col, gradeSize);
+        hashKey ^= ZobristKeys::instance().stone(c, pos->row, pos->col);
         playerFlag = !playerFlag;
         lastPos = *pos;
+        moveHistory[moveCount++] = *pos;
+    }
+
+    // 撤销最后一步，供 AI 搜索时 make/unmake 使用，不需要复制棋盘
+    void undo()
+    {
+        if (moveCount == 0)
+            return;
+
+        ChessPos pos = moveHistory[--moveCount];
+        playerFlag = !playerFlag;
+        int c = colorIndex(playerFlag ? CHESS_BLACK : CHESS_WHITE);
+        board.reset(c, pos.row, pos.col, gradeSize);
+        hashKey ^= ZobristKeys::instance().stone(c, pos.row, pos.col);
+        lastPos = moveCount > 0 ? moveHistory[moveCount - 1] : ChessPos(-1, -1);
+    }
+
+    // 当前轮到哪一方落子
+    chess_kind getSideToMove() const
+    {
+        return playerFlag ? CHESS_BLACK : CHESS_WHITE;
     }
 
-    // 对应 Chess::checkWin() - 100%保留你的算法
-    bool checkWin()
+    // 对应 Chess::checkWin() - 位平面随 updateGameMap() 增量维护，
+    // 只看经过最后一手的四条线，每条线是常数次位运算
+    bool checkWin() const
     {
         int row = lastPos.row;
         int col = lastPos.col;
@@ -114,573 +324,6034 @@ public:
         if (row < 0 || col < 0)
             return false;
 
-        int playerChess = chessMap[row][col];
+        return fiveThrough(board.test(0, row, col) ? 0 : 1, row, col);
+    }
+
+    // kind 方在空位 (row, col) 落子后是否立即五连，AI 用来判断一步胜/必须堵的点，不需要真的落子
+    bool isWinningMove(chess_kind kind, int row, int col) const
+    {
+        if (row < 0 || row >= gradeSize || col < 0 || col >= gradeSize)
+            return false;
+        if (board.test(0, row, col) || board.test(1, row, col))
+            return false;
+        return fiveThrough(colorIndex(kind), row, col);
+    }
+
+    // 对应 Chess::getGradeSize()
+    static constexpr int getGradeSize()
+    {
+        return gradeSize;
+    }
+
+    // 对应 Chess::getChessData()
+    int getChessData(int row, int col) const
+    {
+        if (row < 0 || row >= gradeSize || col < 0 || col >= gradeSize)
+        {
+            return 0;
+        }
+        if (board.test(0, row, col))
+            return CHESS_BLACK;
+        if (board.test(1, row, col))
+            return CHESS_WHITE;
+        return 0;
+    }
 
-        // 1. 水平方向 (----)
-        int count = 1;
-        for (int i = col - 1; i >= 0; i--)
+    // 获取棋盘状态（用于返回给前端）
+    vector<vector<int>> getBoard() const
+    {
+        vector<vector<int>> result(gradeSize, vector<int>(gradeSize, 0));
+        for (int i = 0; i < gradeSize; i++)
         {
-            if (chessMap[row][i] == playerChess)
+            for (int j = 0; j < gradeSize; j++)
             {
-                count++;
+                result[i][j] = getChessData(i, j);
             }
-            else
+        }
+        return result;
+    }
+
+    const BitBoard &getBitBoard() const
+    {
+        return board;
+    }
+
+    // 打包后的棋盘字节数：每格 2 位，13 路为 43 字节
+    static constexpr int packedBytes = (N * N + 3) / 4;
+
+    // 按行优先把棋盘打包成每格 2 位（0 空、1 黑、2 白），第 i 格在第 i/4 字节的 (i%4)*2 位起
+    void packBoard(uint8_t *out) const
+    {
+        memset(out, 0, packedBytes);
+        for (int row = 0; row < N; row++)
+        {
+            uint32_t black = board.rows[0][row];
+            uint32_t white = board.rows[1][row];
+            for (int col = 0; col < N; col++)
             {
-                break;
+                uint32_t code = ((black >> col) & 1u) | (((white >> col) & 1u) << 1);
+                int i = row * N + col;
+                out[i >> 2] |= (uint8_t)(code << ((i & 3) * 2));
             }
         }
-        for (int i = col + 1; i < gradeSize; i++)
+    }
+
+    ChessPos getLastPos() const
+    {
+        return lastPos;
+    }
+
+    int getMoveCount() const
+    {
+        return moveCount;
+    }
+
+    ChessPos getMove(int index) const
+    {
+        return moveHistory[index];
+    }
+
+    int getVersion() const
+    {
+        return version;
+    }
+
+    uint64_t getHash() const
+    {
+        return hashKey;
+    }
+};
+
+// ========================================
+// 棋型工具 - 取出经过某一格的一条线，判断五连、成五点
+// dir: 0 横 (-)、1 竖 (|)、2 右斜 (\)、3 左斜 (/)
+// ========================================
+struct LineView
+{
+    uint32_t own; // 己方棋子
+    uint32_t opp; // 对方棋子
+    int pos;      // 该格在线上的位号
+    int lo;       // 线上有效位的范围 [lo, hi]
+    int hi;
+};
+
+inline LineView lineThrough(const BitBoard &board, int size, int c, int row, int col, int dir)
+{
+    LineView line;
+    int o = 1 - c;
+    if (dir == 0)
+    {
+        line.own = board.rows[c][row];
+        line.opp = board.rows[o][row];
+        line.pos = col;
+        line.lo = 0;
+        line.hi = size - 1;
+    }
+    else if (dir == 1)
+    {
+        line.own = board.cols[c][col];
+        line.opp = board.cols[o][col];
+        line.pos = row;
+        line.lo = 0;
+        line.hi = size - 1;
+    }
+    else if (dir == 2)
+    {
+        int k = row - col;
+        line.own = board.diags[c][k + size - 1];
+        line.opp = board.diags[o][k + size - 1];
+        line.pos = col;
+        line.lo = max(0, -k);
+        line.hi = min(size - 1, size - 1 - k);
+    }
+    else
+    {
+        int d = row + col;
+        line.own = board.antiDiags[c][d];
+        line.opp = board.antiDiags[o][d];
+        line.pos = col;
+        line.lo = max(0, d - (size - 1));
+        line.hi = min(size - 1, d);
+    }
+    return line;
+}
+
+// 线上位号 -> 棋盘坐标（(row, col) 为线上任意一格）
+inline ChessPos linePoint(int row, int col, int dir, int bit)
+{
+    if (dir == 0)
+        return ChessPos(row, bit);
+    if (dir == 1)
+        return ChessPos(bit, col);
+    if (dir == 2)
+        return ChessPos(row + (bit - col), bit);
+    return ChessPos(row - (bit - col), bit);
+}
+
+inline bool hasFiveInLine(uint32_t own)
+{
+    return (own & (own >> 1) & (own >> 2) & (own >> 3) & (own >> 4)) != 0;
+}
+
+// 线上的成五点：在 [from, to] 范围内的 5 格窗口里已有 4 颗己方棋子、没有对方棋子时，剩下的那个空位
+inline uint32_t fivePointsInLine(uint32_t own, uint32_t opp, int from, int to)
+{
+    uint32_t points = 0;
+    for (int w = from; w + 4 <= to; w++)
+    {
+        uint32_t window = 0x1Fu << w;
+        if ((opp & window) == 0 && __builtin_popcount(own & window) == 4)
+            points |= window & ~own;
+    }
+    return points;
+}
+
+// ========================================
+// PatternTable - calculateScore() 的查表版本
+// 一个空位在某个方向上的得分只取决于前后各 4 格的状态，
+// 把这 8 格编码成 16 位下标（低 8 位黑子、高 8 位白子，棋盘外两位都置 1），
+// 启动时按原算法把 65536 种情况全部算好，评分时每个方向查一次表
+// ========================================
+class PatternTable
+{
+private:
+    uint16_t scores[1 << 16];
+    uint8_t reverse4[16]; // 4 位反转，让反向的 4 格也按由近及远排列
+
+    // 沿一个方向由近及远走 4 格，统计连续的 who 方棋子，遇到空位记一次 emptyNum
+    // 与原 calculateScore() 的正向/反向检查完全一致
+    static void walk(int black, int white, int who, int &num, int &emptyNum)
+    {
+        for (int i = 0; i < 4; i++)
         {
-            if (chessMap[row][i] == playerChess)
+            int b = (black >> i) & 1;
+            int w = (white >> i) & 1;
+            int cell = (b && w) ? 2 : (b ? 1 : (w ? -1 : 0)); // 2 表示棋盘外
+
+            if (cell == who)
             {
-                count++;
+                num++;
+            }
+            else if (cell == 0)
+            {
+                emptyNum++;
+                break;
             }
             else
             {
                 break;
             }
         }
-        if (count >= 5)
-            return true;
+    }
+
+    // 对应 AI::calculateScore() 中单个方向的评分 - 100%保留你的算法
+    static int scoreDirection(int index)
+    {
+        int black = index & 0xFF;
+        int white = (index >> 8) & 0xFF;
+        int score = 0;
+
+        int personNum = 0;
+        int emptyNum = 0;
+        walk(black & 0xF, white & 0xF, 1, personNum, emptyNum);
+        walk(black >> 4, white >> 4, 1, personNum, emptyNum);
 
-        // 2. 垂直方向 (|)
-        count = 1;
-        for (int i = row - 1; i >= 0; i--)
+        // 玩家威胁评分
+        if (personNum == 1)
+        {
+            score += 10;
+        }
+        else if (personNum == 2)
         {
-            if (chessMap[i][col] == playerChess)
+            if (emptyNum == 1)
             {
-                count++;
+                score += 30;
             }
-            else
+            else if (emptyNum == 2)
             {
-                break;
+                score += 40;
+            }
+        }
+        else if (personNum == 3)
+        {
+            if (emptyNum == 1)
+            {
+                score += 60;
+            }
+            else if (emptyNum == 2)
+            {
+                score += 200;
             }
         }
-        for (int i = row + 1; i < gradeSize; i++)
+        else if (personNum == 4)
         {
-            if (chessMap[i][col] == playerChess)
+            score += 20000;
+        }
+
+        // 检查AI（白棋）
+        int aiNum = 0;
+        emptyNum = 0;
+        walk(black & 0xF, white & 0xF, -1, aiNum, emptyNum);
+        walk(black >> 4, white >> 4, -1, aiNum, emptyNum);
+
+        // AI进攻评分
+        if (aiNum == 0)
+        {
+            score += 5;
+        }
+        else if (aiNum == 1)
+        {
+            score += 10;
+        }
+        else if (aiNum == 2)
+        {
+            if (emptyNum == 1)
+            {
+                score += 25;
+            }
+            else if (emptyNum == 2)
+            {
+                score += 50;
+            }
+        }
+        else if (aiNum == 3)
+        {
+            if (emptyNum == 1)
+            {
+                score += 55;
+            }
+            else if (emptyNum == 2)
             {
-                count++;
+                score += 10000;
+            }
+        }
+        else if (aiNum == 4)
+        {
+            score += 30000;
+        }
+
+        return score;
+    }
+
+    PatternTable()
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            reverse4[i] = (uint8_t)(((i & 1) << 3) | ((i & 2) << 1) | ((i & 4) >> 1) | ((i & 8) >> 3));
+        }
+        for (int index = 0; index < (1 << 16); index++)
+        {
+            scores[index] = (uint16_t)scoreDirection(index);
+        }
+    }
+
+public:
+    static const PatternTable &instance()
+    {
+        static const PatternTable table;
+        return table;
+    }
+
+    // 一条线上 pos 两侧各 4 格编码成的 8 位：低 4 位正向由近及远，高 4 位反向由近及远
+    // line 为某一方的棋子掩码，border 为线外的位（视为棋盘外）
+    int window(uint32_t line, uint32_t border, int pos) const
+    {
+        uint64_t ext = ((uint64_t)(line | border) << 4) | 0xFu;
+        int forward = (int)((ext >> (pos + 5)) & 0xF);
+        int backward = reverse4[(ext >> pos) & 0xF];
+        return forward | (backward << 4);
+    }
+
+    int score(int index) const
+    {
+        return scores[index];
+    }
+
+    // (row, col) 这个空位四个方向的得分之和，与原 calculateScore() 逐格扫描的结果一致
+    int scoreCell(const BitBoard &board, int size, int row, int col) const
+    {
+        int total = 0;
+        for (int dir = 0; dir < 4; dir++)
+        {
+            LineView line = lineThrough(board, size, 0, row, col, dir);
+            uint32_t border = ~(((1u << (line.hi - line.lo + 1)) - 1) << line.lo);
+            int index = window(line.own, border, line.pos) | (window(line.opp, border, line.pos) << 8);
+            total += scores[index];
+        }
+        return total;
+    }
+};
+
+// ========================================
+// ScoreKernel - calculateScore() 的整盘向量化版本
+// 把棋盘铺成带 4 格边框的 int16 网格（0 空、1 黑、-1 白、2 棋盘外），
+// 一行里连续的格子放进一个向量，沿某方向第 k 格的邻居就是网格偏移 k*step 处的一次非对齐读取，
+// 于是原算法的逐格扫描变成整行同时做的比较和掩码运算。
+// 启动时按 CPU 选择 AVX2 / SSE2 / 标量实现，并与标量版（PatternTable）逐格比对，不一致则退回标量
+// 各实现按棋盘边长 N 实例化，行、列循环的次数都是编译期常量
+// ========================================
+class ScoreKernel
+{
+public:
+    enum Kind
+    {
+        KERNEL_SCALAR,
+        KERNEL_SSE2,
+        KERNEL_AVX2
+    };
+
+private:
+    static const int PAD = 4;
+    static const int STRIDE = 32;
+    static const int GRID_CELLS = STRIDE * (MAX_GRADE_SIZE + 2 * PAD + 1) + 64;
+    static const int16_t BORDER = 2;
+
+    static Kind &activeKind()
+    {
+        static Kind kind = KERNEL_SCALAR;
+        return kind;
+    }
+
+    // 每种边长、每个线程各复用一张网格：边框只在第一次使用时填好，之后只重写棋盘内的格子
+    template <int N>
+    static const int16_t *buildGrid(const BitBoard &board)
+    {
+        alignas(32) static thread_local int16_t grid[GRID_CELLS];
+        static thread_local bool bordered = false;
+
+        if (!bordered)
+        {
+            for (int i = 0; i < GRID_CELLS; i++)
+            {
+                grid[i] = BORDER;
+            }
+            bordered = true;
+        }
+        for (int r = 0; r < N; r++)
+        {
+            int16_t *row = grid + (r + PAD) * STRIDE + PAD;
+            uint32_t black = board.rows[0][r];
+            uint32_t white = board.rows[1][r];
+            for (int c = 0; c < N; c++)
+            {
+                row[c] = (int16_t)(((black >> c) & 1u) - ((white >> c) & 1u));
+            }
+        }
+        return grid;
+    }
+
+    // 把一行（lanes 个格子）四个方向累加好的分数写回 scoreMap，非空位记 0
+    template <int N>
+    static void storeRow(const int16_t *grid, int r, int col0, const int32_t *total, int lanes,
+                         int (*scoreMap)[MAX_GRADE_SIZE])
+    {
+        const int16_t *cells = grid + (r + PAD) * STRIDE + PAD + col0;
+        for (int i = 0; i < lanes && col0 + i < N; i++)
+        {
+            scoreMap[r][col0 + i] = cells[i] == 0 ? total[i] : 0;
+        }
+    }
+
+    template <int N>
+    static void computeScalar(const BitBoard &board, int (*scoreMap)[MAX_GRADE_SIZE])
+    {
+        const PatternTable &table = PatternTable::instance();
+        for (int r = 0; r < N; r++)
+        {
+            uint32_t occupied = board.rows[0][r] | board.rows[1][r];
+            for (int c = 0; c < N; c++)
+            {
+                scoreMap[r][c] = ((occupied >> c) & 1u) ? 0 : table.scoreCell(board, N, r, c);
+            }
+        }
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    // 沿一个方向由近及远的 4 格：s 为“是己方棋子”的掩码，e 为“是空位”的掩码
+    // num 减去连子数（掩码为 -1），ended 为连子后第一格是空位的掩码 —— 与原算法的 break 逻辑一致
+    static inline __attribute__((always_inline)) void raySse2(const __m128i *s, const __m128i *e, __m128i &num, __m128i &ended)
+    {
+        __m128i run = s[0];
+        ended = _mm_or_si128(e[0], _mm_and_si128(run, e[1]));
+        num = _mm_add_epi16(num, run);
+        run = _mm_and_si128(run, s[1]);
+        ended = _mm_or_si128(ended, _mm_and_si128(run, e[2]));
+        num = _mm_add_epi16(num, run);
+        run = _mm_and_si128(run, s[2]);
+        ended = _mm_or_si128(ended, _mm_and_si128(run, e[3]));
+        num = _mm_add_epi16(num, run);
+        run = _mm_and_si128(run, s[3]);
+        num = _mm_add_epi16(num, run);
+    }
+
+    static inline __attribute__((always_inline)) __m128i pickSse2(__m128i mask, int value)
+    {
+        return _mm_and_si128(mask, _mm_set1_epi16((int16_t)value));
+    }
+
+    // 8 路 int16：与 computeAvx2 逻辑相同，注释见那里
+    template <int N>
+    static void computeSse2(const BitBoard &board, int (*scoreMap)[MAX_GRADE_SIZE])
+    {
+        const int16_t *grid = buildGrid<N>(board);
+        const int step[4] = {1, STRIDE, STRIDE + 1, STRIDE - 1};
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i black = _mm_set1_epi16(1);
+        const __m128i white = _mm_set1_epi16(-1);
+        const __m128i k1 = _mm_set1_epi16(1);
+        const __m128i k2 = _mm_set1_epi16(2);
+        const __m128i k3 = _mm_set1_epi16(3);
+        const __m128i k4 = _mm_set1_epi16(4);
+
+        for (int r = 0; r < N; r++)
+        {
+            for (int col0 = 0; col0 < N; col0 += 8)
+            {
+                const int16_t *base = grid + (r + PAD) * STRIDE + PAD + col0;
+                __m128i totalLo = zero;
+                __m128i totalHi = zero;
+
+                for (int d = 0; d < 4; d++)
+                {
+                    __m128i fb[4], fw[4], fe[4], bb[4], bw[4], be[4];
+                    for (int k = 0; k < 4; k++)
+                    {
+                        __m128i f = _mm_loadu_si128((const __m128i *)(base + (k + 1) * step[d]));
+                        __m128i b = _mm_loadu_si128((const __m128i *)(base - (k + 1) * step[d]));
+                        fb[k] = _mm_cmpeq_epi16(f, black);
+                        fw[k] = _mm_cmpeq_epi16(f, white);
+                        fe[k] = _mm_cmpeq_epi16(f, zero);
+                        bb[k] = _mm_cmpeq_epi16(b, black);
+                        bw[k] = _mm_cmpeq_epi16(b, white);
+                        be[k] = _mm_cmpeq_epi16(b, zero);
+                    }
+
+                    __m128i pn = zero, pf = zero, pb = zero;
+                    raySse2(fb, fe, pn, pf);
+                    raySse2(bb, be, pn, pb);
+                    pn = _mm_sub_epi16(zero, pn);
+                    __m128i pe = _mm_sub_epi16(zero, _mm_add_epi16(pf, pb));
+
+                    __m128i an = zero, af = zero, ab = zero;
+                    raySse2(fw, fe, an, af);
+                    raySse2(bw, be, an, ab);
+                    an = _mm_sub_epi16(zero, an);
+                    __m128i ae = _mm_sub_epi16(zero, _mm_add_epi16(af, ab));
+
+                    __m128i pe1 = _mm_cmpeq_epi16(pe, k1), pe2 = _mm_cmpeq_epi16(pe, k2);
+                    __m128i ae1 = _mm_cmpeq_epi16(ae, k1), ae2 = _mm_cmpeq_epi16(ae, k2);
+                    __m128i p2 = _mm_cmpeq_epi16(pn, k2), p3 = _mm_cmpeq_epi16(pn, k3);
+                    __m128i a2 = _mm_cmpeq_epi16(an, k2), a3 = _mm_cmpeq_epi16(an, k3);
+
+                    __m128i score = pickSse2(_mm_cmpeq_epi16(pn, k1), 10);
+                    score = _mm_add_epi16(score, pickSse2(_mm_and_si128(p2, pe1), 30));
+                    score = _mm_add_epi16(score, pickSse2(_mm_and_si128(p2, pe2), 40));
+                    score = _mm_add_epi16(score, pickSse2(_mm_and_si128(p3, pe1), 60));
+                    score = _mm_add_epi16(score, pickSse2(_mm_and_si128(p3, pe2), 200));
+                    score = _mm_add_epi16(score, pickSse2(_mm_cmpeq_epi16(pn, k4), 20000));
+                    score = _mm_add_epi16(score, pickSse2(_mm_cmpeq_epi16(an, zero), 5));
+                    score = _mm_add_epi16(score, pickSse2(_mm_cmpeq_epi16(an, k1), 10));
+                    score = _mm_add_epi16(score, pickSse2(_mm_and_si128(a2, ae1), 25));
+                    score = _mm_add_epi16(score, pickSse2(_mm_and_si128(a2, ae2), 50));
+                    score = _mm_add_epi16(score, pickSse2(_mm_and_si128(a3, ae1), 55));
+                    score = _mm_add_epi16(score, pickSse2(_mm_and_si128(a3, ae2), 10000));
+                    score = _mm_add_epi16(score, pickSse2(_mm_cmpeq_epi16(an, k4), 30000));
+
+                    totalLo = _mm_add_epi32(totalLo, _mm_unpacklo_epi16(score, zero));
+                    totalHi = _mm_add_epi32(totalHi, _mm_unpackhi_epi16(score, zero));
+                }
+
+                alignas(16) int32_t total[8];
+                _mm_store_si128((__m128i *)total, totalLo);
+                _mm_store_si128((__m128i *)(total + 4), totalHi);
+                storeRow<N>(grid, r, col0, total, 8, scoreMap);
+            }
+        }
+    }
+
+    __attribute__((target("avx2"))) static inline __attribute__((always_inline)) void rayAvx2(const __m256i *s, const __m256i *e, __m256i &num, __m256i &ended)
+    {
+        __m256i run = s[0];
+        ended = _mm256_or_si256(e[0], _mm256_and_si256(run, e[1]));
+        num = _mm256_add_epi16(num, run);
+        run = _mm256_and_si256(run, s[1]);
+        ended = _mm256_or_si256(ended, _mm256_and_si256(run, e[2]));
+        num = _mm256_add_epi16(num, run);
+        run = _mm256_and_si256(run, s[2]);
+        ended = _mm256_or_si256(ended, _mm256_and_si256(run, e[3]));
+        num = _mm256_add_epi16(num, run);
+        run = _mm256_and_si256(run, s[3]);
+        num = _mm256_add_epi16(num, run);
+    }
+
+    __attribute__((target("avx2"))) static inline __attribute__((always_inline)) __m256i pickAvx2(__m256i mask, int value)
+    {
+        return _mm256_and_si256(mask, _mm256_set1_epi16((int16_t)value));
+    }
+
+    // 16 路 int16，一个向量覆盖 13 路棋盘的一整行
+    template <int N>
+    __attribute__((target("avx2"))) static void computeAvx2(const BitBoard &board, int (*scoreMap)[MAX_GRADE_SIZE])
+    {
+        const int16_t *grid = buildGrid<N>(board);
+        const int step[4] = {1, STRIDE, STRIDE + 1, STRIDE - 1};
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i black = _mm256_set1_epi16(1);
+        const __m256i white = _mm256_set1_epi16(-1);
+        const __m256i k1 = _mm256_set1_epi16(1);
+        const __m256i k2 = _mm256_set1_epi16(2);
+        const __m256i k3 = _mm256_set1_epi16(3);
+        const __m256i k4 = _mm256_set1_epi16(4);
+
+        for (int r = 0; r < N; r++)
+        {
+            for (int col0 = 0; col0 < N; col0 += 16)
+            {
+                const int16_t *base = grid + (r + PAD) * STRIDE + PAD + col0;
+                __m256i totalLo = zero;
+                __m256i totalHi = zero;
+
+                for (int d = 0; d < 4; d++)
+                {
+                    // 正向/反向由近及远各 4 格，先求出黑、白、空三种比较掩码
+                    __m256i fb[4], fw[4], fe[4], bb[4], bw[4], be[4];
+                    for (int k = 0; k < 4; k++)
+                    {
+                        __m256i f = _mm256_loadu_si256((const __m256i *)(base + (k + 1) * step[d]));
+                        __m256i b = _mm256_loadu_si256((const __m256i *)(base - (k + 1) * step[d]));
+                        fb[k] = _mm256_cmpeq_epi16(f, black);
+                        fw[k] = _mm256_cmpeq_epi16(f, white);
+                        fe[k] = _mm256_cmpeq_epi16(f, zero);
+                        bb[k] = _mm256_cmpeq_epi16(b, black);
+                        bw[k] = _mm256_cmpeq_epi16(b, white);
+                        be[k] = _mm256_cmpeq_epi16(b, zero);
+                    }
+
+                    // 玩家（黑棋）的 personNum / emptyNum
+                    __m256i pn = zero, pf = zero, pb = zero;
+                    rayAvx2(fb, fe, pn, pf);
+                    rayAvx2(bb, be, pn, pb);
+                    pn = _mm256_sub_epi16(zero, pn);
+                    __m256i pe = _mm256_sub_epi16(zero, _mm256_add_epi16(pf, pb));
+
+                    // AI（白棋）的 aiNum / emptyNum
+                    __m256i an = zero, af = zero, ab = zero;
+                    rayAvx2(fw, fe, an, af);
+                    rayAvx2(bw, be, an, ab);
+                    an = _mm256_sub_epi16(zero, an);
+                    __m256i ae = _mm256_sub_epi16(zero, _mm256_add_epi16(af, ab));
+
+                    // 按原算法的分值表加分（单方向最高 50000，按无符号 16 位累加不会溢出）
+                    __m256i pe1 = _mm256_cmpeq_epi16(pe, k1), pe2 = _mm256_cmpeq_epi16(pe, k2);
+                    __m256i ae1 = _mm256_cmpeq_epi16(ae, k1), ae2 = _mm256_cmpeq_epi16(ae, k2);
+                    __m256i p2 = _mm256_cmpeq_epi16(pn, k2), p3 = _mm256_cmpeq_epi16(pn, k3);
+                    __m256i a2 = _mm256_cmpeq_epi16(an, k2), a3 = _mm256_cmpeq_epi16(an, k3);
+
+                    __m256i score = pickAvx2(_mm256_cmpeq_epi16(pn, k1), 10);
+                    score = _mm256_add_epi16(score, pickAvx2(_mm256_and_si256(p2, pe1), 30));
+                    score = _mm256_add_epi16(score, pickAvx2(_mm256_and_si256(p2, pe2), 40));
+                    score = _mm256_add_epi16(score, pickAvx2(_mm256_and_si256(p3, pe1), 60));
+                    score = _mm256_add_epi16(score, pickAvx2(_mm256_and_si256(p3, pe2), 200));
+                    score = _mm256_add_epi16(score, pickAvx2(_mm256_cmpeq_epi16(pn, k4), 20000));
+                    score = _mm256_add_epi16(score, pickAvx2(_mm256_cmpeq_epi16(an, zero), 5));
+                    score = _mm256_add_epi16(score, pickAvx2(_mm256_cmpeq_epi16(an, k1), 10));
+                    score = _mm256_add_epi16(score, pickAvx2(_mm256_and_si256(a2, ae1), 25));
+                    score = _mm256_add_epi16(score, pickAvx2(_mm256_and_si256(a2, ae2), 50));
+                    score = _mm256_add_epi16(score, pickAvx2(_mm256_and_si256(a3, ae1), 55));
+                    score = _mm256_add_epi16(score, pickAvx2(_mm256_and_si256(a3, ae2), 10000));
+                    score = _mm256_add_epi16(score, pickAvx2(_mm256_cmpeq_epi16(an, k4), 30000));
+
+                    // 零扩展成 32 位后累加四个方向
+                    totalLo = _mm256_add_epi32(totalLo, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(score)));
+                    totalHi = _mm256_add_epi32(totalHi, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(score, 1)));
+                }
+
+                alignas(32) int32_t total[16];
+                _mm256_store_si256((__m256i *)total, totalLo);
+                _mm256_store_si256((__m256i *)(total + 8), totalHi);
+                storeRow<N>(grid, r, col0, total, 16, scoreMap);
+            }
+        }
+    }
+#endif
+
+    // 用随机棋盘把 kind 与标量实现逐格比对
+    template <int N>
+    static bool matchesScalar(Kind kind, uint64_t &state)
+    {
+        int expected[MAX_GRADE_SIZE][MAX_GRADE_SIZE];
+        int actual[MAX_GRADE_SIZE][MAX_GRADE_SIZE];
+
+        for (int round = 0; round < 64; round++)
+        {
+            int density = (int)(ZobristKeys::next(state) % 90);
+            BitBoard board;
+            board.clear();
+            for (int r = 0; r < N; r++)
+            {
+                for (int c = 0; c < N; c++)
+                {
+                    uint64_t roll = ZobristKeys::next(state) % 100;
+                    if ((int)roll < density)
+                        board.set(roll % 2 == 0 ? 0 : 1, r, c, N);
+                }
+            }
+
+            computeScalar<N>(board, expected);
+            computeWith<N>(kind, board, actual);
+            for (int r = 0; r < N; r++)
+            {
+                for (int c = 0; c < N; c++)
+                {
+                    if (expected[r][c] != actual[r][c])
+                        return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    static bool matchesScalar(Kind kind)
+    {
+        uint64_t state = 0x2545F4914F6CDD1DULL;
+        return matchesScalar<13>(kind, state) && matchesScalar<15>(kind, state) &&
+               matchesScalar<19>(kind, state);
+    }
+
+public:
+    static const char *name(Kind kind)
+    {
+        return kind == KERNEL_AVX2 ? "avx2" : (kind == KERNEL_SSE2 ? "sse2" : "scalar");
+    }
+
+    // 当前 CPU 能否运行 kind 对应的实现
+    static bool supported(Kind kind)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (kind == KERNEL_AVX2)
+            return __builtin_cpu_supports("avx2");
+        if (kind == KERNEL_SSE2)
+            return __builtin_cpu_supports("sse2");
+        return true;
+#else
+        return kind == KERNEL_SCALAR;
+#endif
+    }
+
+    // 用指定的实现计算，test.cpp 用它逐个比对各实现；kind 须满足 supported()
+    template <int N>
+    static void computeWith(Kind kind, const BitBoard &board, int (*scoreMap)[MAX_GRADE_SIZE])
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        if (kind == KERNEL_AVX2)
+        {
+            computeAvx2<N>(board, scoreMap);
+            return;
+        }
+        if (kind == KERNEL_SSE2)
+        {
+            computeSse2<N>(board, scoreMap);
+            return;
+        }
+#endif
+        computeScalar<N>(board, scoreMap);
+    }
+
+    // 启动时调用一次：按 CPU 支持情况（或 preferred 指定）选择实现并做一致性自检
+    static Kind select(const char *preferred)
+    {
+        Kind kind = KERNEL_SCALAR;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            kind = KERNEL_AVX2;
+        else if (__builtin_cpu_supports("sse2"))
+            kind = KERNEL_SSE2;
+
+        if (preferred != nullptr && strcmp(preferred, "scalar") == 0)
+            kind = KERNEL_SCALAR;
+        else if (preferred != nullptr && strcmp(preferred, "sse2") == 0 && kind != KERNEL_SCALAR)
+            kind = KERNEL_SSE2;
+#endif
+        if (kind != KERNEL_SCALAR && !matchesScalar(kind))
+        {
+            cerr << "警告：" << name(kind) << " 评分内核与标量版本结果不一致，改用标量版本" << endl;
+            kind = KERNEL_SCALAR;
+        }
+        activeKind() = kind;
+        return kind;
+    }
+
+    // 整盘计算 scoreMap（非空位为 0），结果与逐格调用 PatternTable::scoreCell() 完全相同
+    template <int N>
+    static void compute(const BitBoard &board, int (*scoreMap)[MAX_GRADE_SIZE])
+    {
+        computeWith<N>(activeKind(), board, scoreMap);
+    }
+};
+
+// ========================================
+// 局面静态评估（供 AILogic 的 alpha-beta 搜索使用）
+// 扫描所有行、列、斜线上连续的同色棋子，按长度和两端是否为空位打分
+// ========================================
+const int WIN_SCORE = 10000000;
+
+// 一段连子的分值：len 为连子数，openEnds 为两端空位数（0~2）
+inline int runScore(int len, int openEnds)
+{
+    if (len >= 5)
+        return WIN_SCORE;
+    if (openEnds == 0)
+        return 0;
+
+    switch (len)
+    {
+    case 4:
+        return openEnds == 2 ? 100000 : 10000;
+    case 3:
+        return openEnds == 2 ? 5000 : 500;
+    case 2:
+        return openEnds == 2 ? 300 : 30;
+    default:
+        return openEnds == 2 ? 10 : 1;
+    }
+}
+
+// 对一条线打分：own/opp 为双方在该线上的位掩码，[lo, hi] 为线上有效位的范围
+inline int scoreLine(uint32_t own, uint32_t opp, int lo, int hi)
+{
+    uint32_t valid = (hi >= 31 ? 0xFFFFFFFFu : ((1u << (hi + 1)) - 1)) & ~((1u << lo) - 1);
+    uint32_t empty = valid & ~own & ~opp;
+    int score = 0;
+
+    while (own)
+    {
+        int start = __builtin_ctz(own);
+        int len = __builtin_ctz(~(own >> start));
+        int openEnds = 0;
+        if (start > 0 && ((empty >> (start - 1)) & 1u))
+            openEnds++;
+        if (start + len < 32 && ((empty >> (start + len)) & 1u))
+            openEnds++;
+
+        score += runScore(len, openEnds);
+        own &= ~(((len >= 32 ? 0u : (1u << len)) - 1) << start);
+    }
+    return score;
+}
+
+// 从 c 方（0 黑 1 白）角度累加整盘所有线的得分
+inline int scoreSide(const BitBoard &board, int size, int c)
+{
+    int o = 1 - c;
+    int score = 0;
+
+    for (int i = 0; i < size; i++)
+    {
+        score += scoreLine(board.rows[c][i], board.rows[o][i], 0, size - 1);
+        score += scoreLine(board.cols[c][i], board.cols[o][i], 0, size - 1);
+    }
+
+    for (int d = 0; d < 2 * size - 1; d++)
+    {
+        // 右斜：row - col = d - (size - 1)
+        int k = d - (size - 1);
+        int lo = max(0, -k);
+        int hi = min(size - 1, size - 1 - k);
+        if (hi - lo + 1 >= 5)
+            score += scoreLine(board.diags[c][d], board.diags[o][d], lo, hi);
+
+        // 左斜：row + col = d
+        lo = max(0, d - (size - 1));
+        hi = min(size - 1, d);
+        if (hi - lo + 1 >= 5)
+            score += scoreLine(board.antiDiags[c][d], board.antiDiags[o][d], lo, hi);
+    }
+    return score;
+}
+
+// 以 side 方为视角的局面分（正数对 side 有利）
+inline int evaluateBoard(const BitBoard &board, int size, chess_kind side)
+{
+    int c = colorIndex(side);
+    return scoreSide(board, size, c) - scoreSide(board, size, 1 - c);
+}
+
+// ========================================
+// TranspositionTable - 所有对局、所有线程共享的置换表
+// 无锁：每个槽位存 (key ^ data, data) 两个原子量，读出后用异或校验，
+// 被并发写撕裂的槽位校验失败，当作未命中处理
+// ========================================
+enum TTFlag
+{
+    TT_EXACT = 0,
+    TT_LOWER = 1, // 分数是下界（发生了 beta 截断）
+    TT_UPPER = 2  // 分数是上界（没有超过 alpha）
+};
+
+enum TTReplacePolicy
+{
+    TT_REPLACE_DEPTH, // 深度优先：只有更深或旧一代的结果才覆盖
+    TT_REPLACE_ALWAYS // 总是覆盖
+};
+
+struct TTEntry
+{
+    int score;
+    int depth;
+    TTFlag flag;
+    ChessPos move;
+};
+
+class TranspositionTable
+{
+private:
+    struct Slot
+    {
+        atomic<uint64_t> check; // key ^ data
+        atomic<uint64_t> data;
+    };
+
+    // data 布局：score 32 位 | depth 8 位 | flag 2 位 | row 5 位 | col 5 位 | generation 8 位 | ... | valid 1 位
+    // 最高位恒为 1：clear() 后的槽位 data 为 0，而分数、深度、着法、代数全为 0 的真实条目也不会被当成空槽
+    static constexpr uint64_t VALID = 1ULL << 63;
+
+    static uint64_t pack(int score, int depth, TTFlag flag, ChessPos move, unsigned generation)
+    {
+        uint64_t row = move.row < 0 ? 31 : (uint64_t)move.row;
+        uint64_t col = move.col < 0 ? 31 : (uint64_t)move.col;
+        return VALID |
+               (uint64_t)(uint32_t)score |
+               ((uint64_t)(depth & 0xFF) << 32) |
+               ((uint64_t)flag << 40) |
+               (row << 42) |
+               (col << 47) |
+               ((uint64_t)(generation & 0xFF) << 52);
+    }
+
+    static void unpack(uint64_t data, TTEntry &entry)
+    {
+        entry.score = (int)(uint32_t)(data & 0xFFFFFFFFULL);
+        entry.depth = (int)((data >> 32) & 0xFF);
+        entry.flag = (TTFlag)((data >> 40) & 0x3);
+        int row = (int)((data >> 42) & 0x1F);
+        int col = (int)((data >> 47) & 0x1F);
+        entry.move = (row == 31 || col == 31) ? ChessPos(-1, -1) : ChessPos(row, col);
+    }
+
+    static unsigned generationOf(uint64_t data)
+    {
+        return (unsigned)((data >> 52) & 0xFF);
+    }
+
+    unique_ptr<Slot[]> slots;
+    size_t mask;
+    TTReplacePolicy policy;
+    atomic<unsigned> generation;
+
+public:
+    TranspositionTable() : mask(0), policy(TT_REPLACE_DEPTH), generation(0)
+    {
+        resize(16);
+    }
+
+    // 所有对局共用的实例，启动时在 main() 中按配置 resize()
+    static TranspositionTable &shared()
+    {
+        static TranspositionTable table;
+        return table;
+    }
+
+    // 按 MB 设置大小（向下取 2 的幂），会清空表；只能在没有搜索运行时调用
+    void resize(size_t megabytes)
+    {
+        size_t count = max<size_t>(1, megabytes) * 1024 * 1024 / sizeof(Slot);
+        size_t slotCount = 1;
+        while (slotCount * 2 <= count)
+        {
+            slotCount *= 2;
+        }
+        slots.reset(new Slot[slotCount]);
+        mask = slotCount - 1;
+        clear();
+    }
+
+    void clear()
+    {
+        for (size_t i = 0; i <= mask; i++)
+        {
+            slots[i].check.store(0, memory_order_relaxed);
+            slots[i].data.store(0, memory_order_relaxed);
+        }
+    }
+
+    void setPolicy(TTReplacePolicy policy)
+    {
+        this->policy = policy;
+    }
+
+    size_t sizeBytes() const
+    {
+        return (mask + 1) * sizeof(Slot);
+    }
+
+    // 每次根节点搜索开始时调用，旧一代的结果在深度优先策略下也允许被覆盖
+    void newSearch()
+    {
+        generation.fetch_add(1, memory_order_relaxed);
+    }
+
+    bool probe(uint64_t key, TTEntry &entry) const
+    {
+        const Slot &slot = slots[key & mask];
+        uint64_t data = slot.data.load(memory_order_relaxed);
+        uint64_t check = slot.check.load(memory_order_relaxed);
+        if ((check ^ data) != key || (data & VALID) == 0)
+        {
+            return false;
+        }
+        unpack(data, entry);
+        return true;
+    }
+
+    void store(uint64_t key, int score, int depth, TTFlag flag, ChessPos move)
+    {
+        Slot &slot = slots[key & mask];
+        unsigned gen = generation.load(memory_order_relaxed);
+
+        if (policy == TT_REPLACE_DEPTH)
+        {
+            uint64_t oldData = slot.data.load(memory_order_relaxed);
+            uint64_t oldKey = slot.check.load(memory_order_relaxed) ^ oldData;
+            bool sameGeneration = generationOf(oldData) == (gen & 0xFF);
+            if ((oldData & VALID) != 0 && oldKey != key && sameGeneration &&
+                (int)((oldData >> 32) & 0xFF) > depth)
+            {
+                return;
+            }
+        }
+
+        uint64_t data = pack(score, depth, flag, move, gen);
+        slot.data.store(data, memory_order_relaxed);
+        slot.check.store(key ^ data, memory_order_relaxed);
+    }
+};
+
+// AI 难度：depth <= 1 时使用原来的一步贪心，否则进行 alpha-beta 搜索
+struct SearchLimits
+{
+    int depth = 1;           // 搜索深度（层）
+    long long maxNodes = 0;  // 节点预算，0 表示不限
+    int maxWidth = 12;       // 每层最多展开的候选点数
+    int timeBudgetMs = 0;    // 每步的思考时间上限，0 表示不限
+    int vcfDepth = 0;        // 连续冲四求解的最大步数，0 表示不做
+    int vctDepth = 0;        // 连续冲四活三求解的最大步数，0 表示不做
+    long long threatNodes = 0; // 威胁空间搜索的节点预算
+
+    // 客户端通过 /api/new-game 能要到的最大预算
+    static constexpr long long MAX_CLIENT_NODES = 1000000;
+    static constexpr int MAX_CLIENT_TIME_MS = 3000;
+
+    // 预设难度：easy 为原始贪心，normal/hard 逐级加深
+    static bool forDifficulty(const string &name, SearchLimits &limits)
+    {
+        if (name == "easy")
+        {
+            limits.depth = 1;
+            limits.maxNodes = 0;
+            limits.timeBudgetMs = 0;
+            limits.vcfDepth = 0;
+            limits.vctDepth = 0;
+            limits.threatNodes = 0;
+        }
+        else if (name == "normal")
+        {
+            limits.depth = 3;
+            limits.maxNodes = 20000;
+            limits.timeBudgetMs = 200;
+            limits.vcfDepth = 10;
+            limits.vctDepth = 4;
+            limits.threatNodes = 2000;
+        }
+        else if (name == "hard")
+        {
+            limits.depth = 5;
+            limits.maxNodes = 200000;
+            limits.timeBudgetMs = 1000;
+            limits.vcfDepth = 16;
+            limits.vctDepth = 6;
+            limits.threatNodes = 8000;
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+};
+
+// ========================================
+// ThreatSolver - 威胁空间搜索（VCF 连续冲四 / VCT 连续冲四活三）
+// 进攻方每一步都必须是冲四或活三，防守方只考虑有限的应手，
+// 比全宽度搜索便宜得多，用来在常规评估之前找出必胜或必须防守的点
+// ========================================
+template <int N>
+class ThreatSolver
+{
+private:
+    // 每个线程一张小哈希表，记录已证明/已否定的局面，键为 Zobrist 键
+    struct HashSlot
+    {
+        uint64_t key;
+        int depth;
+        bool proven;
+    };
+    static const int HASH_SIZE = 4096;
+
+    // 在 c 方视角下，假设 (row, col) 落子后形成的威胁
+    struct Threat
+    {
+        bool five;          // 直接成五
+        int fiveCount;      // 新增的成五点数量（>= 2 即活四或双四）
+        ChessPos fivePoint; // 其中一个成五点（冲四时防守方唯一的应手）
+        int threeDirs;      // 形成活三的方向（位掩码）
+    };
+
+    ChessLogic<N> *chess;
+    int attacker; // 进攻方位平面下标
+    long long nodes;     // 两轮搜索累计的节点数
+    long long maxNodes;  // 每一轮（VCF、VCT）各自的节点预算
+    long long nodeLimit; // 本轮在 nodes 达到多少时停止
+    chrono::steady_clock::time_point deadline;
+    bool stopped;
+    ChessPos rootMove;
+
+    static HashSlot *hashTable()
+    {
+        static thread_local HashSlot table[HASH_SIZE];
+        return table;
+    }
+
+    bool checkStop()
+    {
+        if (!stopped && (nodes >= nodeLimit ||
+                         ((nodes & 63) == 0 && chrono::steady_clock::now() >= deadline)))
+        {
+            stopped = true;
+        }
+        return stopped;
+    }
+
+    // 已有棋子周围两格内的空位（冲四、活三、成五点都只会出现在这里）
+    void nearbyEmpty(vector<ChessPos> &cells) const
+    {
+        int size = chess->getGradeSize();
+        const BitBoard &board = chess->getBitBoard();
+        uint32_t full = (1u << size) - 1;
+        uint32_t occupied[MAX_GRADE_SIZE];
+        uint32_t spread[MAX_GRADE_SIZE];
+        for (int r = 0; r < size; r++)
+        {
+            uint32_t m = board.rows[0][r] | board.rows[1][r];
+            occupied[r] = m;
+            spread[r] = (m | (m << 1) | (m << 2) | (m >> 1) | (m >> 2)) & full;
+        }
+
+        cells.clear();
+        for (int r = 0; r < size; r++)
+        {
+            uint32_t near = 0;
+            for (int k = max(0, r - 2); k <= min(size - 1, r + 2); k++)
+            {
+                near |= spread[k];
+            }
+            near &= ~occupied[r];
+            while (near)
+            {
+                int c = __builtin_ctz(near);
+                near &= near - 1;
+                cells.push_back(ChessPos(r, c));
+            }
+        }
+    }
+
+    Threat analyze(int c, int row, int col) const
+    {
+        Threat threat = {false, 0, ChessPos(-1, -1), 0};
+        int size = chess->getGradeSize();
+        const BitBoard &board = chess->getBitBoard();
+
+        for (int dir = 0; dir < 4; dir++)
+        {
+            LineView line = lineThrough(board, size, c, row, col, dir);
+            uint32_t own = line.own | (1u << line.pos);
+            int from = max(line.lo, line.pos - 4);
+            int to = min(line.hi, line.pos + 4);
+
+            if (hasFiveInLine(own))
+            {
+                threat.five = true;
+                continue;
+            }
+
+            // 附近不足 3 颗己方棋子（含新子）时不可能形成冲四或活三
+            uint32_t span = ((1u << (to - from + 1)) - 1) << from;
+            if (__builtin_popcount(own & span) < 3)
+                continue;
+
+            uint32_t points = fivePointsInLine(own, line.opp, from, to) & ~line.opp;
+            if (points)
+            {
+                threat.fiveCount += __builtin_popcount(points);
+                threat.fivePoint = linePoint(row, col, dir, __builtin_ctz(points));
+                continue;
+            }
+
+            // 活三：再补一子就能形成两个成五点
+            uint32_t empty = ~(own | line.opp);
+            for (int e = from; e <= to; e++)
+            {
+                if (!((empty >> e) & 1u))
+                    continue;
+                uint32_t next = own | (1u << e);
+                uint32_t nextPoints = fivePointsInLine(next, line.opp, max(line.lo, e - 4), min(line.hi, e + 4));
+                if (__builtin_popcount(nextPoints & ~line.opp) >= 2)
+                {
+                    threat.threeDirs |= 1 << dir;
+                    break;
+                }
+            }
+        }
+        return threat;
+    }
+
+    bool makesFive(int c, int row, int col) const
+    {
+        return chess->isWinningMove(c == 0 ? CHESS_BLACK : CHESS_WHITE, row, col);
+    }
+
+    void collectFivePoints(int c, const vector<ChessPos> &cells, vector<ChessPos> &points) const
+    {
+        points.clear();
+        for (const ChessPos &cell : cells)
+        {
+            if (makesFive(c, cell.row, cell.col))
+                points.push_back(cell);
+        }
+    }
+
+    bool probe(uint64_t key, int depth, bool &proven) const
+    {
+        const HashSlot &slot = hashTable()[key & (HASH_SIZE - 1)];
+        if (slot.key != key)
+            return false;
+        // 已证明的结论对更深的搜索同样成立；否定的结论只对不更深的搜索成立
+        if (slot.proven && slot.depth <= depth)
+        {
+            proven = true;
+            return true;
+        }
+        if (!slot.proven && slot.depth >= depth)
+        {
+            proven = false;
+            return true;
+        }
+        return false;
+    }
+
+    void store(uint64_t key, int depth, bool proven)
+    {
+        if (stopped)
+            return;
+        HashSlot &slot = hashTable()[key & (HASH_SIZE - 1)];
+        slot.key = key;
+        slot.depth = depth;
+        slot.proven = proven;
+    }
+
+    // 进攻方落子后，防守方对冲四只能挡成五点；对活三考虑该线上附近的空位以及防守方自己的冲四
+    bool defendAll(const Threat &threat, const ChessPos &move, bool allowThree, int depth, int ply)
+    {
+        int defender = 1 - attacker;
+        vector<ChessPos> defenses;
+
+        if (threat.fiveCount > 0)
+        {
+            defenses.push_back(threat.fivePoint);
+        }
+        else
+        {
+            int size = chess->getGradeSize();
+            const BitBoard &board = chess->getBitBoard();
+            for (int dir = 0; dir < 4; dir++)
+            {
+                if (!((threat.threeDirs >> dir) & 1))
+                    continue;
+                LineView line = lineThrough(board, size, attacker, move.row, move.col, dir);
+                uint32_t empty = ~(line.own | line.opp);
+                for (int e = max(line.lo, line.pos - 4); e <= min(line.hi, line.pos + 4); e++)
+                {
+                    if ((empty >> e) & 1u)
+                        defenses.push_back(linePoint(move.row, move.col, dir, e));
+                }
+            }
+
+            vector<ChessPos> cells;
+            nearbyEmpty(cells);
+            for (const ChessPos &cell : cells)
+            {
+                if (analyze(defender, cell.row, cell.col).fiveCount > 0)
+                    defenses.push_back(cell);
+            }
+        }
+
+        for (const ChessPos &defense : defenses)
+        {
+            chess->chessDown(defense.row, defense.col, chess->getSideToMove());
+            bool won = !chess->checkWin() && solve(allowThree, depth - 1, ply + 1);
+            chess->undo();
+            if (!won || stopped)
+                return false;
+        }
+        return true;
+    }
+
+    // 进攻方行棋：能否在 depth 步威胁之内取胜
+    bool solve(bool allowThree, int depth, int ply)
+    {
+        nodes++;
+        if (checkStop())
+            return false;
+
+        int defender = 1 - attacker;
+        vector<ChessPos> cells;
+        vector<ChessPos> points;
+        nearbyEmpty(cells);
+
+        // 自己有成五点，直接获胜
+        collectFivePoints(attacker, cells, points);
+        if (!points.empty())
+        {
+            if (ply == 0)
+                rootMove = points[0];
+            return true;
+        }
+
+        // 对方有成五点：两个以上挡不住；一个则必须去挡，而且这一手本身要是威胁
+        collectFivePoints(defender, cells, points);
+        if (points.size() > 1 || depth <= 0)
+            return false;
+        if (points.size() == 1)
+            cells.assign(1, points[0]);
+
+        uint64_t key = chess->getHash() ^ (allowThree ? 0x5bd1e9955bd1e995ULL : 0);
+        bool proven = false;
+        if (ply > 0 && probe(key, depth, proven))
+            return proven;
+
+        vector<Threat> threats;
+        threats.reserve(cells.size());
+        for (const ChessPos &move : cells)
+        {
+            threats.push_back(analyze(attacker, move.row, move.col));
+        }
+
+        // 先试冲四，再试活三
+        for (int pass = 0; pass < (allowThree ? 2 : 1); pass++)
+        {
+            for (size_t i = 0; i < cells.size(); i++)
+            {
+                const ChessPos &move = cells[i];
+                const Threat &threat = threats[i];
+                bool isFour = threat.fiveCount > 0;
+                if (pass == 0 ? !isFour : (isFour || threat.threeDirs == 0))
+                    continue;
+
+                bool won;
+                chess->chessDown(move.row, move.col, chess->getSideToMove());
+                if (threat.fiveCount >= 2)
+                    won = true; // 活四或双四，对方挡不完
+                else
+                    won = defendAll(threat, move, allowThree, depth, ply);
+                chess->undo();
+
+                if (stopped)
+                    return false;
+                if (won)
+                {
+                    if (ply == 0)
+                        rootMove = move;
+                    store(key, depth, true);
+                    return true;
+                }
+            }
+        }
+
+        store(key, depth, false);
+        return false;
+    }
+
+public:
+    ThreatSolver(ChessLogic<N> *chess, long long maxNodes, chrono::steady_clock::time_point deadline)
+        : chess(chess), attacker(colorIndex(chess->getSideToMove())), nodes(0),
+          maxNodes(maxNodes), nodeLimit(maxNodes), deadline(deadline), stopped(false), rootMove(-1, -1)
+    {
+    }
+
+    // 当前行棋方的必然应手：成五、挡对方的冲四、VCF、VCT，依次尝试
+    // 找到时写入 move 并返回 true
+    bool findForcedMove(int vcfDepth, int vctDepth, ChessPos &move)
+    {
+        vector<ChessPos> cells;
+        vector<ChessPos> points;
+        nearbyEmpty(cells);
+
+        collectFivePoints(attacker, cells, points);
+        if (!points.empty())
+        {
+            move = points[0];
+            return true;
+        }
+
+        collectFivePoints(1 - attacker, cells, points);
+        if (!points.empty())
+        {
+            move = points[0];
+            return true;
+        }
+
+        if (vcfDepth > 0 && solve(false, vcfDepth, 0))
+        {
+            move = rootMove;
+            return true;
+        }
+
+        // VCT 另起一份节点预算，否则 VCF 用完预算时 VCT 一个节点都搜不了
+        stopped = false;
+        nodeLimit = nodes + maxNodes;
+        if (vctDepth > 0 && solve(true, vctDepth, 0))
+        {
+            move = rootMove;
+            return true;
+        }
+        return false;
+    }
+
+    long long getNodeCount() const
+    {
+        return nodes;
+    }
+};
+
+// ========================================
+// Metrics - 进程内指标，由 /metrics 按 Prometheus 文本格式输出
+// 计数器和直方图都按线程分片：每个线程固定写自己的分片（各占独立的缓存行），
+// 只在抓取时把所有分片加起来，请求线程之间没有共享的写热点
+// ========================================
+static const int METRIC_SHARDS = 16;
+
+// 当前线程的分片号，首次调用时轮流分配
+inline int metricShard()
+{
+    static atomic<int> nextShard{0};
+    static thread_local int shard = nextShard.fetch_add(1, memory_order_relaxed) % METRIC_SHARDS;
+    return shard;
+}
+
+class ShardedCounter
+{
+private:
+    struct alignas(64) Cell
+    {
+        atomic<long long> value{0};
+    };
+    Cell cells[METRIC_SHARDS];
+
+public:
+    void add(long long n = 1)
+    {
+        cells[metricShard()].value.fetch_add(n, memory_order_relaxed);
+    }
+
+    long long value() const
+    {
+        long long total = 0;
+        for (const Cell &cell : cells)
+        {
+            total += cell.value.load(memory_order_relaxed);
+        }
+        return total;
+    }
+};
+
+// 对数-线性分桶（HDR 风格）：按微秒计，每个 2 的幂区间再均分 4 档，相对误差不超过 25%
+class LatencyHistogram
+{
+public:
+    static const int SUB_BITS = 2;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int MAX_EXP = 27; // 2^27 微秒约 134 秒，更大的值计入最后一档
+    static const int BUCKETS = (MAX_EXP - SUB_BITS + 2) * SUB_COUNT;
+
+private:
+    struct alignas(64) Shard
+    {
+        atomic<uint64_t> counts[BUCKETS];
+        atomic<uint64_t> sumMicros;
+    };
+    Shard shards[METRIC_SHARDS];
+
+    static int bucketOf(uint64_t micros)
+    {
+        if (micros < (uint64_t)SUB_COUNT)
+            return (int)micros;
+        int exp = 63 - __builtin_clzll(micros);
+        int sub = (int)((micros >> (exp - SUB_BITS)) & (SUB_COUNT - 1));
+        return min((exp - SUB_BITS + 1) * SUB_COUNT + sub, BUCKETS - 1);
+    }
+
+public:
+    LatencyHistogram()
+    {
+        for (Shard &shard : shards)
+        {
+            for (atomic<uint64_t> &count : shard.counts)
+            {
+                count.store(0, memory_order_relaxed);
+            }
+            shard.sumMicros.store(0, memory_order_relaxed);
+        }
+    }
+
+    void record(int64_t micros)
+    {
+        uint64_t value = micros > 0 ? (uint64_t)micros : 0;
+        Shard &shard = shards[metricShard()];
+        shard.counts[bucketOf(value)].fetch_add(1, memory_order_relaxed);
+        shard.sumMicros.fetch_add(value, memory_order_relaxed);
+    }
+
+    void record(chrono::steady_clock::duration elapsed)
+    {
+        record(chrono::duration_cast<chrono::microseconds>(elapsed).count());
+    }
+
+    // 按 Prometheus histogram 输出；le 取 2 的幂微秒（恰好是分桶边界），单位换算成秒
+    void render(string &out, const char *name, const string &labels) const
+    {
+        uint64_t counts[BUCKETS] = {};
+        uint64_t sumMicros = 0;
+        for (const Shard &shard : shards)
+        {
+            for (int i = 0; i < BUCKETS; i++)
+            {
+                counts[i] += shard.counts[i].load(memory_order_relaxed);
+            }
+            sumMicros += shard.sumMicros.load(memory_order_relaxed);
+        }
+
+        string prefix = labels.empty() ? "{" : "{" + labels + ",";
+        uint64_t cumulative = 0;
+        int next = 0;
+        char line[256];
+        for (int exp = SUB_BITS; exp <= MAX_EXP; exp++)
+        {
+            // 下标小于 (exp - SUB_BITS + 1) * SUB_COUNT 的桶都小于 2^exp 微秒
+            int limit = (exp - SUB_BITS + 1) * SUB_COUNT;
+            for (; next < limit; next++)
+            {
+                cumulative += counts[next];
+            }
+            snprintf(line, sizeof(line), "%s_bucket%sle=\"%g\"} %llu\n", name, prefix.c_str(),
+                     (double)(1ULL << exp) / 1e6, (unsigned long long)cumulative);
+            out += line;
+        }
+        for (; next < BUCKETS; next++)
+        {
+            cumulative += counts[next];
+        }
+        snprintf(line, sizeof(line), "%s_bucket%sle=\"+Inf\"} %llu\n", name, prefix.c_str(),
+                 (unsigned long long)cumulative);
+        out += line;
+
+        string plain = labels.empty() ? "" : "{" + labels + "}";
+        snprintf(line, sizeof(line), "%s_sum%s %.6f\n%s_count%s %llu\n", name, plain.c_str(),
+                 (double)sumMicros / 1e6, name, plain.c_str(), (unsigned long long)cumulative);
+        out += line;
+    }
+};
+
+// 全局指标：按接口统计的请求数和延迟，AI 思考时间，整盘评分时间
+struct ServerMetrics
+{
+    enum Route
+    {
+        ROUTE_NEW_GAME,
+        ROUTE_MOVE,
+        ROUTE_BOARD,
+        ROUTE_OTHER,
+        ROUTE_COUNT
+    };
+
+    ShardedCounter requests[ROUTE_COUNT];
+    LatencyHistogram latency[ROUTE_COUNT];
+    LatencyHistogram aiThink;
+    LatencyHistogram calculateScore;
+
+    static ServerMetrics &instance()
+    {
+        static ServerMetrics metrics;
+        return metrics;
+    }
+
+    static Route routeOf(const string &path)
+    {
+        if (path == "/api/new-game")
+            return ROUTE_NEW_GAME;
+        if (path == "/api/move")
+            return ROUTE_MOVE;
+        if (path.compare(0, 11, "/api/board/") == 0)
+            return ROUTE_BOARD;
+        return ROUTE_OTHER;
+    }
+
+    static const char *routeName(Route route)
+    {
+        static const char *names[] = {"/api/new-game", "/api/move", "/api/board", "other"};
+        return names[route];
+    }
+
+    void render(string &out) const
+    {
+        out += "# HELP gobang_http_requests_total Requests handled, by route.\n";
+        out += "# TYPE gobang_http_requests_total counter\n";
+        for (int r = 0; r < ROUTE_COUNT; r++)
+        {
+            out += "gobang_http_requests_total{route=\"";
+            out += routeName((Route)r);
+            out += "\"} " + to_string(requests[r].value()) + "\n";
+        }
+
+        out += "# HELP gobang_http_request_duration_seconds Request latency, by route.\n";
+        out += "# TYPE gobang_http_request_duration_seconds histogram\n";
+        for (int r = 0; r < ROUTE_COUNT; r++)
+        {
+            latency[r].render(out, "gobang_http_request_duration_seconds",
+                              string("route=\"") + routeName((Route)r) + "\"");
+        }
+
+        out += "# HELP gobang_ai_think_seconds Time spent choosing each AI move.\n";
+        out += "# TYPE gobang_ai_think_seconds histogram\n";
+        aiThink.render(out, "gobang_ai_think_seconds", "");
+
+        out += "# HELP gobang_calculate_score_seconds Time spent on full-board score recomputation.\n";
+        out += "# TYPE gobang_calculate_score_seconds histogram\n";
+        calculateScore.render(out, "gobang_calculate_score_seconds", "");
+    }
+};
+
+// 单值指标（gauge / counter）
+inline void renderMetricValue(string &out, const char *name, const char *type, const char *help, long long value)
+{
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+    out += name;
+    out += ' ' + to_string(value) + '\n';
+}
+
+// ========================================
+// AILogic 类 - 从你的 AI.cpp 改编
+// ========================================
+template <int N>
+class AILogic
+{
+private:
+    ChessLogic<N> *chess;
+    int scoreMap[MAX_GRADE_SIZE][MAX_GRADE_SIZE];
+    int syncedVersion; // scoreMap 对应的棋盘版本
+    int syncedMoves;   // scoreMap 已经计入的落子数
+    SearchLimits limits;
+    long long nodes;    // 本次搜索已访问的节点数
+    int completedDepth; // 本次搜索最后完整搜完的深度
+    bool stopped;       // 时间或节点预算用完，当前迭代作废
+    chrono::steady_clock::time_point deadline;
+    Rng rng;            // 同分点之间随机选择，由会话的种子初始化
+
+    // 生成候选点：已有棋子周围两格以内的空位，按 scoreCell() 从高到低排序并截断
+    void generateMoves(vector<ChessPos> &moves) const
+    {
+        int size = chess->getGradeSize();
+        const BitBoard &board = chess->getBitBoard();
+        uint32_t full = (1u << size) - 1;
+
+        uint32_t occupied[MAX_GRADE_SIZE];
+        uint32_t spread[MAX_GRADE_SIZE];
+        for (int r = 0; r < size; r++)
+        {
+            uint32_t m = board.rows[0][r] | board.rows[1][r];
+            occupied[r] = m;
+            spread[r] = (m | (m << 1) | (m << 2) | (m >> 1) | (m >> 2)) & full;
+        }
+
+        vector<pair<int, ChessPos>> scored;
+        for (int r = 0; r < size; r++)
+        {
+            uint32_t near = 0;
+            for (int k = max(0, r - 2); k <= min(size - 1, r + 2); k++)
+            {
+                near |= spread[k];
+            }
+            near &= ~occupied[r];
+
+            while (near)
+            {
+                int c = __builtin_ctz(near);
+                near &= near - 1;
+                scored.push_back(make_pair(scoreCell(r, c), ChessPos(r, c)));
+            }
+        }
+
+        sort(scored.begin(), scored.end(),
+             [](const pair<int, ChessPos> &a, const pair<int, ChessPos> &b)
+             { return a.first > b.first; });
+
+        moves.clear();
+        for (size_t i = 0; i < scored.size() && (int)i < limits.maxWidth; i++)
+        {
+            moves.push_back(scored[i].second);
+        }
+    }
+
+    // 置换表里的胜负分按“距当前节点的步数”存储，读写时与 ply 互相换算
+    static int scoreToTT(int score, int ply)
+    {
+        if (score > WIN_SCORE - 1000)
+            return score + ply;
+        if (score < -WIN_SCORE + 1000)
+            return score - ply;
+        return score;
+    }
+
+    static int scoreFromTT(int score, int ply)
+    {
+        if (score > WIN_SCORE - 1000)
+            return score - ply;
+        if (score < -WIN_SCORE + 1000)
+            return score + ply;
+        return score;
+    }
+
+    // 每 64 个节点检查一次时间，超时或节点数用完就中止当前迭代
+    bool shouldStop()
+    {
+        if (!stopped && ((limits.maxNodes > 0 && nodes >= limits.maxNodes) ||
+                         ((nodes & 63) == 0 && chrono::steady_clock::now() >= deadline)))
+        {
+            stopped = true;
+        }
+        return stopped;
+    }
+
+    // 把置换表给出的最佳着法挪到候选列表最前面
+    static void promoteMove(vector<ChessPos> &moves, ChessPos first)
+    {
+        for (size_t i = 1; i < moves.size(); i++)
+        {
+            if (moves[i].row == first.row && moves[i].col == first.col)
+            {
+                rotate(moves.begin(), moves.begin() + i, moves.begin() + i + 1);
+                break;
+            }
+        }
+    }
+
+    // negamax + alpha-beta，返回当前行棋方视角的分数
+    // 中止后返回值无意义，由调用方丢弃
+    int negamax(int depth, int ply, int alpha, int beta)
+    {
+        nodes++;
+
+        // 上一步落子方已经五连
+        if (chess->checkWin())
+            return -(WIN_SCORE - ply);
+
+        if (depth == 0)
+        {
+            return evaluateBoard(chess->getBitBoard(), chess->getGradeSize(), chess->getSideToMove());
+        }
+        if (shouldStop())
+            return 0;
+
+        TranspositionTable &tt = TranspositionTable::shared();
+        uint64_t key = chess->getHash();
+        int alphaOrig = alpha;
+        TTEntry entry;
+        ChessPos ttMove(-1, -1);
+        if (tt.probe(key, entry))
+        {
+            ttMove = entry.move;
+            if (entry.depth >= depth)
+            {
+                int value = scoreFromTT(entry.score, ply);
+                if (entry.flag == TT_EXACT)
+                    return value;
+                if (entry.flag == TT_LOWER && value >= beta)
+                    return value;
+                if (entry.flag == TT_UPPER && value <= alpha)
+                    return value;
+            }
+        }
+
+        vector<ChessPos> moves;
+        generateMoves(moves);
+        if (moves.empty())
+            return 0;
+        if (ttMove.row >= 0)
+            promoteMove(moves, ttMove);
+
+        // 一步就能五连时不必展开子节点
+        chess_kind side = chess->getSideToMove();
+        for (const ChessPos &move : moves)
+        {
+            if (chess->isWinningMove(side, move.row, move.col))
+                return WIN_SCORE - ply - 1;
+        }
+
+        int best = -WIN_SCORE - 1;
+        ChessPos bestMove = moves[0];
+        for (const ChessPos &move : moves)
+        {
+            chess->chessDown(move.row, move.col, side);
+            int value = -negamax(depth - 1, ply + 1, -beta, -alpha);
+            chess->undo();
+
+            if (stopped)
+                return 0;
+
+            if (value > best)
+            {
+                best = value;
+                bestMove = move;
+            }
+            if (best > alpha)
+                alpha = best;
+            if (alpha >= beta)
+                break;
+        }
+
+        TTFlag flag = best <= alphaOrig ? TT_UPPER : (best >= beta ? TT_LOWER : TT_EXACT);
+        tt.store(key, scoreToTT(best, ply), depth, flag, bestMove);
+        return best;
+    }
+
+    // 根节点迭代加深：depth = 1, 2, ... 逐层搜索，
+    // 超时则丢弃未完成的一层，返回上一层完整搜索的最佳点
+    ChessPos searchBestMove()
+    {
+        nodes = 0;
+        completedDepth = 0;
+        stopped = false;
+        TranspositionTable &tt = TranspositionTable::shared();
+        tt.newSearch();
+
+        vector<ChessPos> moves;
+        generateMoves(moves);
+        if (moves.empty())
+        {
+            // 棋盘上还没有棋子，交给贪心评估
+            return think();
+        }
+
+        ChessPos bestMove = moves[0];
+        for (int depth = 1; depth <= limits.depth; depth++)
+        {
+            promoteMove(moves, bestMove);
+
+            ChessPos iterationBest = moves[0];
+            int alpha = -WIN_SCORE - 1;
+            int beta = WIN_SCORE + 1;
+            for (const ChessPos &move : moves)
+            {
+                chess->chessDown(move.row, move.col, chess->getSideToMove());
+                int value = -negamax(depth - 1, 1, -beta, -alpha);
+                chess->undo();
+
+                if (stopped)
+                    break;
+
+                if (value > alpha)
+                {
+                    alpha = value;
+                    iterationBest = move;
+                }
+            }
+
+            if (stopped)
+                break;
+
+            bestMove = iterationBest;
+            completedDepth = depth;
+            tt.store(chess->getHash(), scoreToTT(alpha, 0), depth, TT_EXACT, bestMove);
+
+            // 已经找到必胜或必败的结论，再加深也不会改变选择
+            if (alpha > WIN_SCORE - 1000 || alpha < -WIN_SCORE + 1000)
+                break;
+        }
+        return bestMove;
+    }
+
+public:
+    AILogic() : chess(nullptr), syncedVersion(-1), syncedMoves(0), nodes(0),
+                completedDepth(0), stopped(false)
+    {
+        memset(scoreMap, 0, sizeof(scoreMap));
+    }
+
+    // 对应 AI::init()
+    void init(ChessLogic<N> *chess)
+    {
+        this->chess = chess;
+        memset(scoreMap, 0, sizeof(scoreMap));
+        syncedVersion = -1;
+        syncedMoves = 0;
+    }
+
+    // 重新设定随机种子：同一种子 + 同样的落子顺序，贪心 AI 的应手完全相同
+    void seed(uint64_t seed)
+    {
+        rng.seed(seed);
+    }
+
+    void setSearchLimits(const SearchLimits &limits)
+    {
+        this->limits = limits;
+    }
+
+    const SearchLimits &getSearchLimits() const
+    {
+        return limits;
+    }
+
+    long long getNodeCount() const
+    {
+        return nodes;
+    }
+
+    int getCompletedDepth() const
+    {
+        return completedDepth;
+    }
+
+    // 对应 AI::go()：不限时间
+    ChessPos go()
+    {
+        return go(chrono::steady_clock::time_point::max());
+    }
+
+    // 带截止时间的版本：迭代加深直到 deadline，返回最后一层完整搜索的结果
+    ChessPos go(chrono::steady_clock::time_point deadline)
+    {
+        // 先做威胁空间搜索，找到必胜或必须防守的点就直接返回，最多占用三分之一的时间
+        if (limits.vcfDepth > 0 || limits.vctDepth > 0)
+        {
+            auto now = chrono::steady_clock::now();
+            auto threatDeadline = deadline == chrono::steady_clock::time_point::max()
+                                      ? deadline
+                                      : now + (deadline - now) / 3;
+            ThreatSolver<N> solver(chess, limits.threatNodes, threatDeadline);
+            ChessPos forced;
+            if (solver.findForcedMove(limits.vcfDepth, limits.vctDepth, forced))
+            {
+                completedDepth = 0;
+                nodes = solver.getNodeCount();
+                return forced;
+            }
+        }
+
+        if (limits.depth <= 1)
+        {
+            completedDepth = 1;
+            return think();
+        }
+        this->deadline = deadline;
+        return searchBestMove();
+    }
+
+    // 对应 AI::think()
+    ChessPos think()
+    {
+        updateScore();
+
+        vector<ChessPos> maxPoints;
+        int maxScore = 0;
+        int size = chess->getGradeSize();
+
+        for (int row = 0; row < size; row++)
+        {
+            for (int col = 0; col < size; col++)
+            {
+                if (chess->getChessData(row, col) != 0)
+                    continue;
+
+                if (scoreMap[row][col] > maxScore)
+                {
+                    maxScore = scoreMap[row][col];
+                    maxPoints.clear();
+                    maxPoints.push_back(ChessPos(row, col));
+                }
+                else if (scoreMap[row][col] == maxScore)
+                {
+                    maxPoints.push_back(ChessPos(row, col));
+                }
+            }
+        }
+
+        if (maxPoints.empty())
+        {
+            return ChessPos(-1, -1);
+        }
+
+        int ind = rng.below((uint32_t)maxPoints.size());
+        return maxPoints[ind];
+    }
+
+    // 对应 AI::calculateScore() - 100%保留你的算法
+    // 全盘重算，棋盘被重置或首次计算时使用；由 ScoreKernel 整盘向量化计算
+    void calculateScore()
+    {
+        auto start = chrono::steady_clock::now();
+        ScoreKernel::compute<N>(chess->getBitBoard(), scoreMap);
+        ServerMetrics::instance().calculateScore.record(chrono::steady_clock::now() - start);
+
+        syncedVersion = chess->getVersion();
+        syncedMoves = chess->getMoveCount();
+    }
+
+    // 增量更新：只重算上次同步之后每一步落子所在四条线上半径 4 以内的空位
+    // 一个空位的分数只取决于它四条线上前后各 4 格，所以其余格子的分数不会变
+    void updateScore()
+    {
+        if (syncedVersion != chess->getVersion() || syncedMoves > chess->getMoveCount())
+        {
+            calculateScore();
+            return;
+        }
+
+        int size = chess->getGradeSize();
+        static const int dirs[4][2] = {{0, 1}, {1, 0}, {1, 1}, {1, -1}};
+
+        for (int m = syncedMoves; m < chess->getMoveCount(); m++)
+        {
+            ChessPos pos = chess->getMove(m);
+            scoreMap[pos.row][pos.col] = 0;
+
+            for (int d = 0; d < 4; d++)
+            {
+                for (int i = -4; i <= 4; i++)
+                {
+                    int row = pos.row + i * dirs[d][0];
+                    int col = pos.col + i * dirs[d][1];
+
+                    if (i == 0 || row < 0 || row >= size || col < 0 || col >= size)
+                        continue;
+
+                    scoreMap[row][col] = chess->getChessData(row, col) ? 0 : scoreCell(row, col);
+                }
+            }
+        }
+
+        syncedMoves = chess->getMoveCount();
+    }
+
+    // 单个空位的评分（玩家威胁 + AI进攻，四个方向累加），查 PatternTable 得到
+    int scoreCell(int row, int col) const
+    {
+        return PatternTable::instance().scoreCell(chess->getBitBoard(), chess->getGradeSize(), row, col);
+    }
+};
+
+// ========================================
+// ServerConfig - 服务器运行参数
+// 默认值可以用同名环境变量覆盖，例如 GOBANG_IDLE_TTL=600
+// ========================================
+struct ServerConfig
+{
+    int idleTtlSeconds = 1800;    // 无人访问多久后回收对局
+    int finishedTtlSeconds = 60;  // 已结束的对局保留多久（0 表示结束即删除）
+    int maxSessions = 10000;      // 同时存活的对局上限，超出时按最久未访问淘汰
+    int reapIntervalSeconds = 30; // 后台回收线程的扫描间隔
+    int ttMegabytes = 16;         // 共享置换表大小（MB）
+    string ttPolicy = "depth";    // 置换表覆盖策略：depth / always
+    string logFile = "server.log"; // 日志文件路径（超过 logMaxMegabytes 时轮转），为空时写标准输出
+    int logMaxMegabytes = 64;     // 单个日志文件的上限，超过后轮转
+    int logKeepFiles = 3;         // 轮转时保留的旧文件个数
+    int wsPort = 8889;            // WebSocket 对局通道的端口，0 表示不开启
+    int wsMaxConnections = 1024;  // WebSocket 同时连接数上限（每条连接一个线程）
+    int sseMaxStreams = 0;        // 同时打开的 SSE 事件流上限；0 表示 epoll 前端 4096，httplib 前端 64（每条另占一个线程）
+    int aiThreads = 0;            // AI 搜索线程数，0 表示 CPU 核数
+    int aiQueue = 256;            // AI 队列最多排多少步，超出时拒绝落子
+    int aiWaitMs = 500;           // 落子请求最多等 AI 多久，超时返回 ticket 让客户端稍后来取
+    string frontend = "epoll";    // HTTP 前端：epoll（事件循环）/ httplib（每条连接占一个线程）
+    int eventLoops = 0;           // epoll 事件循环个数，0 表示 CPU 核数
+    int keepAliveSeconds = 120;   // epoll 前端关闭空闲 keep-alive 连接的时间
+
+    static int envInt(const char *name, int defaultValue)
+    {
+        const char *value = getenv(name);
+        if (value == nullptr || *value == '\0')
+        {
+            return defaultValue;
+        }
+        return atoi(value);
+    }
+
+    static ServerConfig fromEnv()
+    {
+        ServerConfig config;
+        config.idleTtlSeconds = envInt("GOBANG_IDLE_TTL", config.idleTtlSeconds);
+        config.finishedTtlSeconds = envInt("GOBANG_FINISHED_TTL", config.finishedTtlSeconds);
+        config.maxSessions = envInt("GOBANG_MAX_SESSIONS", config.maxSessions);
+        config.reapIntervalSeconds = envInt("GOBANG_REAP_INTERVAL", config.reapIntervalSeconds);
+        config.ttMegabytes = envInt("GOBANG_TT_MB", config.ttMegabytes);
+        config.logMaxMegabytes = envInt("GOBANG_LOG_MAX_MB", config.logMaxMegabytes);
+        config.logKeepFiles = envInt("GOBANG_LOG_KEEP", config.logKeepFiles);
+        config.wsPort = envInt("GOBANG_WS_PORT", config.wsPort);
+        config.wsMaxConnections = envInt("GOBANG_WS_MAX_CONNECTIONS", config.wsMaxConnections);
+        config.sseMaxStreams = envInt("GOBANG_SSE_MAX_STREAMS", config.sseMaxStreams);
+        config.aiThreads = envInt("GOBANG_AI_THREADS", config.aiThreads);
+        config.aiQueue = envInt("GOBANG_AI_QUEUE", config.aiQueue);
+        config.aiWaitMs = envInt("GOBANG_AI_WAIT_MS", config.aiWaitMs);
+        config.eventLoops = envInt("GOBANG_EVENT_LOOPS", config.eventLoops);
+        config.keepAliveSeconds = envInt("GOBANG_KEEPALIVE", config.keepAliveSeconds);
+        // GOBANG_LOG_FILE=- 表示写标准输出（不轮转）
+        const char *logFile = getenv("GOBANG_LOG_FILE");
+        if (logFile != nullptr)
+        {
+            config.logFile = strcmp(logFile, "-") == 0 ? "" : logFile;
+        }
+        const char *policy = getenv("GOBANG_TT_POLICY");
+        if (policy != nullptr && *policy != '\0')
+        {
+            config.ttPolicy = policy;
+        }
+        const char *frontend = getenv("GOBANG_FRONTEND");
+        if (frontend != nullptr && *frontend != '\0')
+        {
+            config.frontend = frontend;
+        }
+        return config;
+    }
+};
+
+// 单调时钟毫秒数，用于会话的访问时间
+inline int64_t nowMs()
+{
+    return chrono::duration_cast<chrono::milliseconds>(
+               chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// ========================================
+// Logger - 异步日志
+// 请求线程只把一行文本拷进无锁的多生产者环形缓冲区（每个槽位带序号，满了就丢弃并计数），
+// 后台线程批量取出、加上时间和级别后一次写入日志文件；文件超过上限时按 .1 .2 ... 轮转。
+// 低于 GOBANG_LOG_LEVEL 的日志在编译期就被去掉
+// 用法：LOG_INFO("玩家落子").kv("gameId", gameId).kv("pos", pos);
+// ========================================
+enum LogLevel
+{
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR
+};
+
+#ifndef GOBANG_LOG_LEVEL
+#define GOBANG_LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+class Logger
+{
+public:
+    static const int TEXT_BYTES = 232; // 每条日志正文的上限，超出部分截断
+
+private:
+    static const int RING_SIZE = 8192; // 必须是 2 的幂
+
+    struct Slot
+    {
+        atomic<uint64_t> sequence;
+        int64_t timeMs;
+        LogLevel level;
+        uint16_t length;
+        char text[TEXT_BYTES];
+    };
+
+    Slot ring[RING_SIZE];
+    atomic<uint64_t> tail;   // 生产者下一个要占用的位置
+    uint64_t head;           // 只由写线程读写
+    atomic<long long> dropped;
+
+    string path;             // 为空时写到标准输出
+    long long maxBytes;
+    int keepFiles;
+    FILE *file;
+    long long fileBytes;
+
+    thread writer;
+    mutex wakeMutex;
+    condition_variable wakeCv;
+    bool stopping;
+
+    Logger()
+        : tail(0), head(0), dropped(0), maxBytes(0), keepFiles(0),
+          file(stdout), fileBytes(0), stopping(false)
+    {
+        for (uint64_t i = 0; i < RING_SIZE; i++)
+        {
+            ring[i].sequence.store(i, memory_order_relaxed);
+        }
+    }
+
+    ~Logger()
+    {
+        stop();
+    }
+
+    static const char *levelName(LogLevel level)
+    {
+        static const char *names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+        return names[level];
+    }
+
+    // 当前文件写满后：path.(k-1) -> path.k，path -> path.1，再重新打开 path
+    void rotate()
+    {
+        fclose(file);
+        for (int k = keepFiles - 1; k >= 1; k--)
+        {
+            rename((path + "." + to_string(k)).c_str(), (path + "." + to_string(k + 1)).c_str());
+        }
+        if (keepFiles > 0)
+            rename(path.c_str(), (path + ".1").c_str());
+        else
+            remove(path.c_str());
+
+        file = fopen(path.c_str(), "a");
+        if (file == nullptr)
+            file = stdout;
+        fileBytes = 0;
+    }
+
+    // 取出目前所有已写完的槽位，拼成一批一次写出
+    void drain(string &batch)
+    {
+        batch.clear();
+        char stamp[32];
+        int64_t stampSecond = -1;
+
+        while (true)
+        {
+            Slot &slot = ring[head & (RING_SIZE - 1)];
+            if (slot.sequence.load(memory_order_acquire) != head + 1)
+                break;
+
+            int64_t second = slot.timeMs / 1000;
+            if (second != stampSecond)
+            {
+                time_t t = (time_t)second;
+                struct tm local;
+                localtime_r(&t, &local);
+                strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+                stampSecond = second;
+            }
+            char millis[8];
+            snprintf(millis, sizeof(millis), ".%03d ", (int)(slot.timeMs % 1000));
+
+            batch += stamp;
+            batch += millis;
+            batch += levelName(slot.level);
+            batch += ' ';
+            batch.append(slot.text, slot.length);
+            batch += '\n';
+
+            slot.sequence.store(head + RING_SIZE, memory_order_release);
+            head++;
+        }
+
+        long long lost = dropped.exchange(0, memory_order_relaxed);
+        if (lost > 0)
+        {
+            batch += "[日志] 缓冲区已满，丢弃 " + to_string(lost) + " 条\n";
+        }
+
+        if (!batch.empty())
+        {
+            fwrite(batch.data(), 1, batch.size(), file);
+            fflush(file);
+            fileBytes += (long long)batch.size();
+            if (file != stdout && maxBytes > 0 && fileBytes >= maxBytes)
+                rotate();
+        }
+    }
+
+    void writerLoop()
+    {
+        string batch;
+        unique_lock<mutex> lock(wakeMutex);
+        while (!stopping)
+        {
+            // 生产者不做任何通知，写线程定时醒来取一批
+            wakeCv.wait_for(lock, chrono::milliseconds(50));
+            lock.unlock();
+            drain(batch);
+            lock.lock();
+        }
+        lock.unlock();
+        drain(batch);
+    }
+
+public:
+    static Logger &instance()
+    {
+        static Logger logger;
+        return logger;
+    }
+
+    // 打开日志文件并启动写线程；path 为空时写标准输出（不轮转）
+    void start(const string &path, long long maxBytes, int keepFiles)
+    {
+        this->path = path;
+        this->maxBytes = maxBytes;
+        this->keepFiles = keepFiles;
+        if (!path.empty())
+        {
+            FILE *f = fopen(path.c_str(), "a");
+            if (f != nullptr)
+            {
+                file = f;
+                fseek(file, 0, SEEK_END);
+                fileBytes = ftell(file);
+            }
+            else
+            {
+                cerr << "警告：无法打开日志文件 " << path << "，改为输出到标准输出" << endl;
+            }
+        }
+        stopping = false;
+        writer = thread(&Logger::writerLoop, this);
+    }
+
+    // 停止写线程，写完缓冲区里剩余的日志
+    void stop()
+    {
+        {
+            lock_guard<mutex> lock(wakeMutex);
+            stopping = true;
+        }
+        wakeCv.notify_all();
+        if (writer.joinable())
+        {
+            writer.join();
+        }
+        if (file != stdout && file != nullptr)
+        {
+            fclose(file);
+            file = stdout;
+        }
+    }
+
+    // 任意线程调用；缓冲区满时丢弃这一条并返回 false，不会阻塞
+    bool push(LogLevel level, const char *text, size_t length)
+    {
+        uint64_t pos = tail.load(memory_order_relaxed);
+        Slot *slot;
+        while (true)
+        {
+            slot = &ring[pos & (RING_SIZE - 1)];
+            uint64_t sequence = slot->sequence.load(memory_order_acquire);
+            int64_t diff = (int64_t)(sequence - pos);
+            if (diff == 0)
+            {
+                if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                dropped.fetch_add(1, memory_order_relaxed);
+                return false;
+            }
+            else
+            {
+                pos = tail.load(memory_order_relaxed);
+            }
+        }
+
+        slot->timeMs = chrono::duration_cast<chrono::milliseconds>(
+                           chrono::system_clock::now().time_since_epoch())
+                           .count();
+        slot->level = level;
+        slot->length = (uint16_t)min(length, (size_t)TEXT_BYTES);
+        memcpy(slot->text, text, slot->length);
+        slot->sequence.store(pos + 1, memory_order_release);
+
+        // 每写满半个缓冲区提前叫醒写线程，避免突发流量时等到定时器才取
+        if ((pos & (RING_SIZE / 2 - 1)) == 0 && pos > 0)
+            wakeCv.notify_one();
+        return true;
+    }
+};
+
+// 一条日志：在栈上拼好 "[事件] key=value ..." 文本，语句结束时交给 Logger
+class LogLine
+{
+private:
+    LogLevel level;
+    size_t length;
+    char text[Logger::TEXT_BYTES];
+
+    void append(const char *data, size_t n)
+    {
+        n = min(n, sizeof(text) - length);
+        memcpy(text + length, data, n);
+        length += n;
+    }
+
+    void append(string_view v)
+    {
+        append(v.data(), v.size());
+    }
+
+    template <typename T>
+    void appendNumber(T value)
+    {
+        char digits[24];
+        auto result = to_chars(digits, digits + sizeof(digits), value);
+        append(digits, (size_t)(result.ptr - digits));
+    }
+
+    void beginField(const char *key)
+    {
+        append(" ", 1);
+        append(key);
+        append("=", 1);
+    }
+
+public:
+    LogLine(LogLevel level, const char *event) : level(level), length(0)
+    {
+        append("[", 1);
+        append(event);
+        append("]", 1);
+    }
+
+    LogLine(const LogLine &) = delete;
+    LogLine &operator=(const LogLine &) = delete;
+
+    ~LogLine()
+    {
+        Logger::instance().push(level, text, length);
+    }
+
+    LogLine &kv(const char *key, string_view value)
+    {
+        beginField(key);
+        append(value);
+        return *this;
+    }
+
+    LogLine &kv(const char *key, const char *value)
+    {
+        return kv(key, string_view(value));
+    }
+
+    LogLine &kv(const char *key, const string &value)
+    {
+        return kv(key, string_view(value));
+    }
+
+    LogLine &kv(const char *key, int value)
+    {
+        beginField(key);
+        appendNumber(value);
+        return *this;
+    }
+
+    LogLine &kv(const char *key, long long value)
+    {
+        beginField(key);
+        appendNumber(value);
+        return *this;
+    }
+
+    LogLine &kv(const char *key, uint64_t value)
+    {
+        beginField(key);
+        appendNumber(value);
+        return *this;
+    }
+
+    LogLine &kv(const char *key, const ChessPos &pos)
+    {
+        beginField(key);
+        append("(", 1);
+        appendNumber(pos.row);
+        append(",", 1);
+        appendNumber(pos.col);
+        append(")", 1);
+        return *this;
+    }
+};
+
+// 级别低于 GOBANG_LOG_LEVEL 时条件在编译期为假，整条语句连同参数求值一起被优化掉
+#define GOBANG_LOG(level, event)        \
+    if ((level) < GOBANG_LOG_LEVEL)     \
+    {                                   \
+    }                                   \
+    else                                \
+        LogLine((level), (event))
+
+#define LOG_DEBUG(event) GOBANG_LOG(LOG_LEVEL_DEBUG, event)
+#define LOG_INFO(event) GOBANG_LOG(LOG_LEVEL_INFO, event)
+#define LOG_WARN(event) GOBANG_LOG(LOG_LEVEL_WARN, event)
+#define LOG_ERROR(event) GOBANG_LOG(LOG_LEVEL_ERROR, event)
+
+class JsonWriter;
+
+// ========================================
+// MoveOutcome / AiTicket - 一步落子的结果，以及排队等待中的 AI 应手
+// ========================================
+struct MoveOutcome
+{
+    bool valid = false;         // 玩家这一步是否落得下去
+    int winner = 0;             // CHESS_BLACK / CHESS_WHITE，0 表示还没分出胜负
+    ChessPos aiMove{-1, -1};    // AI 的应手，没有时为 (-1,-1)
+
+    const char *winnerName() const
+    {
+        return winner == CHESS_BLACK ? "black" : "white";
+    }
+
+    // 写出 /api/move 响应的字段，定义在 JsonWriter 之后
+    void writeFields(JsonWriter &response) const;
+};
+
+// 一次排队中的 AI 应手。请求线程最多等一会儿，没等到就把编号交给客户端，之后凭编号取结果
+struct AiTicket
+{
+    const int number;    // 玩家落子后的总步数
+    const string moveId; // 触发这次计算的 moveId，重试的请求凭它找回同一张 ticket
+
+    AiTicket(int number, const string &moveId) : number(number), moveId(moveId), done(false) {}
+
+    void complete(const MoveOutcome &result)
+    {
+        {
+            lock_guard<mutex> lock(resultMutex);
+            outcome = result;
+            done = true;
+        }
+        finished.notify_all();
+    }
+
+    bool isDone()
+    {
+        lock_guard<mutex> lock(resultMutex);
+        return done;
+    }
+
+    // 最多等待 timeout，算完时把结果写进 result 并返回 true
+    bool wait(chrono::milliseconds timeout, MoveOutcome &result)
+    {
+        unique_lock<mutex> lock(resultMutex);
+        if (!finished.wait_for(lock, timeout, [this] { return done; }))
+            return false;
+        result = outcome;
+        return true;
+    }
+
+    // 算完后调用 callback（WebSocket 连接用它推送 AI 的应手，不必占着线程等）
+    // 已经算完时立即在当前线程调用，否则由 runCallbacks() 在 AI 线程里调用
+    void onComplete(function<void(const MoveOutcome &)> callback)
+    {
+        unique_lock<mutex> lock(resultMutex);
+        if (!done)
+        {
+            callbacks.push_back(move(callback));
+            return;
+        }
+        MoveOutcome result = outcome;
+        lock.unlock();
+        callback(result);
+    }
+
+    // complete() 之后、放开对局的 moveMutex 之后调用，回调里的网络写不会卡住这一局
+    void runCallbacks()
+    {
+        vector<function<void(const MoveOutcome &)>> ready;
+        MoveOutcome result;
+        {
+            lock_guard<mutex> lock(resultMutex);
+            ready.swap(callbacks);
+            result = outcome;
+        }
+        for (auto &callback : ready)
+            callback(result);
+    }
+
+private:
+    mutex resultMutex;
+    condition_variable finished;
+    bool done;
+    MoveOutcome outcome;
+    vector<function<void(const MoveOutcome &)>> callbacks;
+};
+
+// ========================================
+// GameEventLog - 一局的事件流，/api/events/:gameId 的数据源
+// 每个事件发生时格式化成一段完整的 SSE 文本，只序列化一次；
+// 所有订阅者共享同一份文本，各自只记一个读到第几个事件的游标
+// ========================================
+class GameEventLog
+{
+private:
+    mutex eventsMutex;
+    condition_variable changed;
+    vector<shared_ptr<const string>> events; // 第 i 个事件的 id 为 i + 1
+    bool closed = false;
+    unordered_map<int, function<void()>> watchers;
+    int nextWatcher = 0;
+
+    // 调用方持有 eventsMutex
+    void notifyWatchers()
+    {
+        for (auto &entry : watchers)
+            entry.second();
+    }
+
+    void publish(const char *event, const string &data)
+    {
+        {
+            lock_guard<mutex> lock(eventsMutex);
+            if (closed)
+                return;
+            string frame = "id: " + to_string(events.size() + 1) + "\nevent: " + event + "\ndata: " + data + "\n\n";
+            events.push_back(make_shared<const string>(move(frame)));
+            notifyWatchers();
+        }
+        changed.notify_all();
+    }
+
+    static const char *colorName(int kind)
+    {
+        return kind == CHESS_BLACK ? "black" : "white";
+    }
+
+public:
+    // 第 moveCount 手落在 (row, col)
+    void publishMove(int moveCount, int row, int col, int kind)
+    {
+        publish("move", "{\"moveCount\":" + to_string(moveCount) + ",\"row\":" + to_string(row) +
+                            ",\"col\":" + to_string(col) + ",\"color\":\"" + colorName(kind) + "\"}");
+    }
+
+    // 分出胜负后不会再有新事件
+    void publishGameOver(int winner)
+    {
+        publish("gameOver", string("{\"winner\":\"") + colorName(winner) + "\"}");
+        close();
+    }
+
+    // 对局结束或被回收，订阅者读完已有事件后结束
+    void close()
+    {
+        {
+            lock_guard<mutex> lock(eventsMutex);
+            closed = true;
+            notifyWatchers();
+        }
+        changed.notify_all();
+    }
+
+    // 不阻塞读取的订阅者（epoll 事件循环）登记的回调：有新事件或关闭时调用，之后用 read(..., 0ms) 取。
+    // 回调在发布者的线程里、持有 eventsMutex 时执行，只能做唤醒之类的轻量操作；unwatch() 返回后不会再被调用
+    int watch(function<void()> callback)
+    {
+        lock_guard<mutex> lock(eventsMutex);
+        int id = ++nextWatcher;
+        watchers.emplace(id, move(callback));
+        return id;
+    }
+
+    void unwatch(int id)
+    {
+        lock_guard<mutex> lock(eventsMutex);
+        watchers.erase(id);
+    }
+
+    // 取出 cursor 之后的所有事件，暂时没有时最多等待 timeout
+    // 返回 false 表示事件流已关闭且全部读完
+    bool read(size_t &cursor, vector<shared_ptr<const string>> &out, chrono::milliseconds timeout)
+    {
+        unique_lock<mutex> lock(eventsMutex);
+        changed.wait_for(lock, timeout, [&]
+                         { return cursor < events.size() || closed; });
+        out.clear();
+        if (cursor < events.size())
+        {
+            out.assign(events.begin() + cursor, events.end());
+            cursor = events.size();
+        }
+        return !(closed && out.empty());
+    }
+};
+
+// ========================================
+// GameSession - 一局游戏的全部状态
+// 与棋盘边长无关的部分放在基类里；BoardSession<N> 再带上定长的棋盘和 AI，
+// 整个会话由 make_shared 一次分配。处理函数通过 visit() 拿到具体的 BoardSession<N>
+// ========================================
+template <int N>
+struct BoardSession;
+
+struct GameSession
+{
+    string gameId;
+    const int gradeSize;
+    const uint64_t seed; // AI 随机数种子，记录下来以便按同样的落子复盘
+
+    // 串行化同一局的落子和 AI 搜索；不同局各自一把锁，可以完全并行
+    mutex moveMutex;
+
+    // 幂等：记录最近一次落子的 moveId 和结果，客户端重试时直接复用
+    string lastMoveId;
+    MoveOutcome lastOutcome;
+
+    // 正在排队或计算中的 AI 应手；单独一把锁，查询时不必等正在搜索的 moveMutex
+    mutex ticketMutex;
+    shared_ptr<AiTicket> aiTicket;
+
+    // 保护 BoardSession::snapshot。读棋盘只拿这把锁，不会被 AI 搜索挡住
+    mutex snapshotMutex;
+
+    // 生命周期：最近访问时间，以及对局是否已经分出胜负
+    atomic<int64_t> lastAccessMs;
+    atomic<bool> finished;
+
+    // 落子和胜负事件，供 SSE 订阅者读取
+    GameEventLog events;
+
+    GameSession(const string &gameId, int gradeSize, uint64_t seed)
+        : gameId(gameId), gradeSize(gradeSize), seed(seed),
+          lastAccessMs(nowMs()), finished(false)
+    {
+    }
+
+    virtual ~GameSession() = default;
+
+    // ai 持有指向 chess 的指针，禁止拷贝
+    GameSession(const GameSession &) = delete;
+    GameSession &operator=(const GameSession &) = delete;
+
+    void touch()
+    {
+        lastAccessMs.store(nowMs(), memory_order_relaxed);
+    }
+
+    // 支持的棋盘边长，每种对应一个 BoardSession<N> 实例化
+    static bool isSupportedSize(int gradeSize)
+    {
+        return gradeSize == 13 || gradeSize == 15 || gradeSize == 19;
+    }
+
+    static shared_ptr<GameSession> create(const string &gameId, int gradeSize, uint64_t seed);
+
+    // 按 gradeSize 转成 BoardSession<N> 后调用 f，f 一般是 [&](auto &game) { ... }
+    template <typename F>
+    void visit(F &&f);
+};
+
+template <int N>
+struct BoardSession : GameSession
+{
+    ChessLogic<N> chess;    // AI 搜索时会在上面试走，只在持有 moveMutex 时访问
+    ChessLogic<N> snapshot; // 只记录真正落下的棋子，供 /api/board 等读取
+    AILogic<N> ai;
+
+    BoardSession(const string &gameId, uint64_t seed)
+        : GameSession(gameId, N, seed)
+    {
+        chess.init();
+        snapshot.init();
+        ai.init(&chess);
+        ai.seed(seed);
+    }
+
+    // 一步棋落到 chess 上之后调用：同步到快照，并发布到事件流
+    void recordMove(int row, int col, chess_kind kind)
+    {
+        {
+            lock_guard<mutex> lock(snapshotMutex);
+            snapshot.chessDown(row, col, kind);
+        }
+        events.publishMove(chess.getMoveCount(), row, col, kind);
+    }
+};
+
+inline shared_ptr<GameSession> GameSession::create(const string &gameId, int gradeSize, uint64_t seed)
+{
+    switch (gradeSize)
+    {
+    case 15:
+        return make_shared<BoardSession<15>>(gameId, seed);
+    case 19:
+        return make_shared<BoardSession<19>>(gameId, seed);
+    default:
+        return make_shared<BoardSession<13>>(gameId, seed);
+    }
+}
+
+template <typename F>
+void GameSession::visit(F &&f)
+{
+    switch (gradeSize)
+    {
+    case 15:
+        f(static_cast<BoardSession<15> &>(*this));
+        break;
+    case 19:
+        f(static_cast<BoardSession<19> &>(*this));
+        break;
+    default:
+        f(static_cast<BoardSession<13> &>(*this));
+        break;
+    }
+}
+
+// ========================================
+// SessionStore - 按 gameId 哈希分片的会话表
+// 每个分片一把读写锁，查找只加读锁；不同分片之间互不阻塞
+// maxSessions 是全部分片合计的上限：超出时先在新会话所在的分片淘汰，该分片没有可淘汰的再依次看其他分片
+// 后台回收线程逐个分片清理超时和已结束的对局
+// ========================================
+class SessionStore
+{
+private:
+    static const int SHARD_COUNT = 16;
+
+    struct Shard
+    {
+        mutable shared_mutex mutex;
+        unordered_map<string, shared_ptr<GameSession>> sessions;
+    };
+
+    ServerConfig config;
+    Shard shards[SHARD_COUNT];
+    atomic<long long> gameIdCounter;
+    atomic<long long> liveCount;
+    atomic<long long> evictionCount;
+    atomic<long long> reapedCount;
+    atomic<uint64_t> seedState;
+
+    thread reaper;
+    mutex reaperMutex;
+    condition_variable reaperCv;
+    bool stopping;
+
+    Shard &shardFor(const string &gameId)
+    {
+        return shards[hash<string>()(gameId) % SHARD_COUNT];
+    }
+
+    const Shard &shardFor(const string &gameId) const
+    {
+        return shards[hash<string>()(gameId) % SHARD_COUNT];
+    }
+
+    bool isExpired(const GameSession &session, int64_t now) const
+    {
+        int64_t idle = now - session.lastAccessMs.load(memory_order_relaxed);
+        int64_t ttl = session.finished.load(memory_order_relaxed) ? config.finishedTtlSeconds
+                                                                   : config.idleTtlSeconds;
+        return idle >= ttl * 1000LL;
+    }
+
+    // 会话总数超限时淘汰分片里最久未访问的对局，已结束的对局优先，keep 不参与淘汰（调用方持有写锁）
+    // 被淘汰的会话移入 victims，在锁外析构；分片里没有可淘汰的对局时返回 false
+    bool evictOldest(Shard &shard, vector<shared_ptr<GameSession>> &victims, const string &keep = string())
+    {
+        auto oldest = shard.sessions.end();
+        for (auto it = shard.sessions.begin(); it != shard.sessions.end(); ++it)
+        {
+            if (it->first == keep)
+                continue;
+            if (oldest == shard.sessions.end())
+            {
+                oldest = it;
+                continue;
+            }
+            bool itFinished = it->second->finished.load(memory_order_relaxed);
+            bool oldestFinished = oldest->second->finished.load(memory_order_relaxed);
+            if (itFinished != oldestFinished)
+            {
+                if (itFinished)
+                    oldest = it;
+                continue;
+            }
+            if (it->second->lastAccessMs.load(memory_order_relaxed) <
+                oldest->second->lastAccessMs.load(memory_order_relaxed))
+            {
+                oldest = it;
+            }
+        }
+        if (oldest == shard.sessions.end())
+            return false;
+        victims.push_back(oldest->second);
+        shard.sessions.erase(oldest);
+        liveCount--;
+        evictionCount++;
+        return true;
+    }
+
+    // 被移除的会话不会再有落子，结束它们的事件流，订阅者随之断开
+    static void closeEvents(const vector<shared_ptr<GameSession>> &victims)
+    {
+        for (const auto &victim : victims)
+        {
+            victim->events.close();
+        }
+    }
+
+    void reaperLoop()
+    {
+        unique_lock<mutex> lock(reaperMutex);
+        while (!stopping)
+        {
+            reaperCv.wait_for(lock, chrono::seconds(config.reapIntervalSeconds));
+            if (stopping)
+                break;
+
+            lock.unlock();
+            size_t removed = sweep();
+            if (removed > 0)
+            {
+                LOG_INFO("回收对局").kv("count", (long long)removed).kv("live", liveCount.load());
+            }
+            lock.lock();
+        }
+    }
+
+public:
+    explicit SessionStore(const ServerConfig &config = ServerConfig())
+        : config(config), gameIdCounter(0), liveCount(0), evictionCount(0), reapedCount(0),
+          seedState((uint64_t)chrono::system_clock::now().time_since_epoch().count()), stopping(false)
+    {
+    }
+
+    ~SessionStore()
+    {
+        stopReaper();
+    }
+
+    // 为新对局生成随机种子；限制在 53 位以内，前端 JavaScript 的数字可以原样回传
+    uint64_t nextSeed()
+    {
+        uint64_t state = seedState.fetch_add(0x9E3779B97F4A7C15ULL, memory_order_relaxed);
+        return ZobristKeys::next(state) & ((1ULL << 53) - 1);
+    }
+
+    // 创建新会话并分配 gameId，gradeSize 须通过 GameSession::isSupportedSize() 检查
+    shared_ptr<GameSession> create(int gradeSize, uint64_t seed)
+    {
+        string gameId = "game_" + to_string(++gameIdCounter);
+        auto session = GameSession::create(gameId, gradeSize, seed);
+
+        long long limit = max(1, config.maxSessions);
+        vector<shared_ptr<GameSession>> victims;
+        size_t home = hash<string>()(gameId) % SHARD_COUNT;
+        {
+            Shard &shard = shards[home];
+            unique_lock<shared_mutex> lock(shard.mutex);
+            shard.sessions[gameId] = session;
+            liveCount++;
+            while (liveCount.load() > limit && evictOldest(shard, victims, gameId))
+            {
+            }
+        }
+        // 本分片淘汰不动（只剩新建的这一局）时到其他分片淘汰，一次只锁一个分片
+        for (size_t i = 1; i < SHARD_COUNT && liveCount.load() > limit; i++)
+        {
+            Shard &other = shards[(home + i) % SHARD_COUNT];
+            unique_lock<shared_mutex> lock(other.mutex);
+            while (liveCount.load() > limit && evictOldest(other, victims))
+            {
+            }
+        }
+        closeEvents(victims);
+        return session;
+    }
+
+    // 查找会话并刷新访问时间，不存在时返回空指针
+    shared_ptr<GameSession> find(const string &gameId) const
+    {
+        const Shard &shard = shardFor(gameId);
+        shared_lock<shared_mutex> lock(shard.mutex);
+        auto it = shard.sessions.find(gameId);
+        if (it == shard.sessions.end())
+        {
+            return nullptr;
+        }
+        it->second->touch();
+        return it->second;
+    }
+
+    bool erase(const string &gameId)
+    {
+        shared_ptr<GameSession> victim;
+        Shard &shard = shardFor(gameId);
+        unique_lock<shared_mutex> lock(shard.mutex);
+        auto it = shard.sessions.find(gameId);
+        if (it == shard.sessions.end())
+        {
+            return false;
+        }
+        victim = it->second;
+        shard.sessions.erase(it);
+        liveCount--;
+        return true;
+    }
+
+    // 对局分出胜负：标记为已结束，保留 finishedTtlSeconds 供客户端取最终棋盘
+    void retire(GameSession &session)
+    {
+        session.finished.store(true, memory_order_relaxed);
+        if (config.finishedTtlSeconds <= 0)
+        {
+            erase(session.gameId);
+        }
+    }
+
+    // 扫描一遍所有分片，删除超时的会话，返回删除数量
+    // 每次只锁一个分片，且只在锁内摘除指针，会话在锁外析构
+    size_t sweep()
+    {
+        int64_t now = nowMs();
+        size_t removed = 0;
+        for (Shard &shard : shards)
+        {
+            vector<shared_ptr<GameSession>> victims;
+            {
+                unique_lock<shared_mutex> lock(shard.mutex);
+                for (auto it = shard.sessions.begin(); it != shard.sessions.end();)
+                {
+                    if (isExpired(*it->second, now))
+                    {
+                        victims.push_back(it->second);
+                        it = shard.sessions.erase(it);
+                        liveCount--;
+                    }
+                    else
+                    {
+                        ++it;
+                    }
+                }
+            }
+            closeEvents(victims);
+            removed += victims.size();
+        }
+        reapedCount += (long long)removed;
+        return removed;
+    }
+
+    void startReaper()
+    {
+        stopping = false;
+        reaper = thread(&SessionStore::reaperLoop, this);
+    }
+
+    void stopReaper()
+    {
+        {
+            lock_guard<mutex> lock(reaperMutex);
+            stopping = true;
+        }
+        reaperCv.notify_all();
+        if (reaper.joinable())
+        {
+            reaper.join();
+        }
+    }
+
+    size_t size() const
+    {
+        return (size_t)liveCount.load();
+    }
+
+    // 因总数超限被淘汰的会话数
+    long long evictions() const
+    {
+        return evictionCount.load();
+    }
+
+    // 被回收线程按闲置 / 结束超时清理的会话数
+    long long reaped() const
+    {
+        return reapedCount.load();
+    }
+};
+
+// ========================================
+// ServerLoad - 请求队列的负载情况
+// 排队的请求越多，AI 每步的思考时间就压得越短，保证落子接口的延迟上限
+// ========================================
+struct ServerLoad
+{
+    atomic<int> queuedRequests{0}; // 已进入线程池但还没开始处理的请求数
+    int workerCount = 1;
+
+    // 队列不超过线程数时用满预算；之后按 线程数/排队数 的比例缩减，最少保留 10%
+    int effectiveBudgetMs(int budgetMs) const
+    {
+        if (budgetMs <= 0)
+        {
+            return budgetMs;
+        }
+        int queued = queuedRequests.load(memory_order_relaxed);
+        if (queued <= workerCount)
+        {
+            return budgetMs;
+        }
+        return max(budgetMs / 10, (int)((long long)budgetMs * workerCount / queued));
+    }
+};
+
+// ========================================
+// MonitoredThreadPool - 包装 httplib::ThreadPool，统计排队中的请求数
+// ========================================
+class MonitoredThreadPool : public httplib::TaskQueue
+{
+private:
+    httplib::ThreadPool pool;
+    ServerLoad &load;
+
+public:
+    // streamThreads：另外留给 SSE 事件流的线程，事件流再多也不会占用处理请求的 workerCount 个线程
+    MonitoredThreadPool(ServerLoad &load, int streamThreads = 0)
+        : pool(load.workerCount + streamThreads), load(load)
+    {
+    }
+
+    bool enqueue(function<void()> fn) override
+    {
+        load.queuedRequests++;
+        bool ok = pool.enqueue([this, fn = move(fn)]()
+                               {
+            load.queuedRequests--;
+            fn(); });
+        if (!ok)
+        {
+            load.queuedRequests--;
+        }
+        return ok;
+    }
+
+    void shutdown() override
+    {
+        pool.shutdown();
+    }
+};
+
+// ========================================
+// AiWorkerPool - AI 搜索专用的线程池
+// 落子接口只校验并落下玩家这一步，搜索排进这里的有界队列，HTTP 线程不再被搜索占住。
+// 先 tryReserve() 占名额再落子，队列满时拒绝这一步，不会出现玩家已落子却排不上队的情况
+// ========================================
+class AiWorkerPool
+{
+private:
+    ServerLoad stats; // queuedRequests = 排队中的任务数，workerCount = 线程数
+    int capacity;     // 排队 + 计算中的任务上限
+    atomic<int> outstanding;
+    atomic<long long> rejectedCount;
+
+    mutex queueMutex;
+    condition_variable queueCv;
+    deque<function<void()>> jobs;
+    bool stopping;
+    vector<thread> workers;
+
+    void workerLoop()
+    {
+        while (true)
+        {
+            function<void()> job;
+            {
+                unique_lock<mutex> lock(queueMutex);
+                queueCv.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty())
+                    return; // 停止时先把队列里的任务做完
+                job = move(jobs.front());
+                jobs.pop_front();
+            }
+            stats.queuedRequests--;
+            job();
+            outstanding--;
+        }
+    }
+
+public:
+    AiWorkerPool(int threads, int queueLimit)
+        : capacity(max(1, threads) + max(0, queueLimit)), outstanding(0), rejectedCount(0), stopping(false)
+    {
+        stats.workerCount = max(1, threads);
+    }
+
+    ~AiWorkerPool()
+    {
+        stop();
+    }
+
+    void start()
+    {
+        stopping = false;
+        for (int i = 0; i < stats.workerCount; i++)
+        {
+            workers.emplace_back(&AiWorkerPool::workerLoop, this);
+        }
+    }
+
+    void stop()
+    {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueCv.notify_all();
+        for (thread &worker : workers)
+        {
+            worker.join();
+        }
+        workers.clear();
+    }
+
+    // 占一个名额；成功后必须调用 post() 或 cancelReservation()
+    bool tryReserve()
+    {
+        int current = outstanding.load(memory_order_relaxed);
+        while (current < capacity)
+        {
+            if (outstanding.compare_exchange_weak(current, current + 1))
+                return true;
+        }
+        rejectedCount++;
+        return false;
+    }
+
+    void cancelReservation()
+    {
+        outstanding--;
+    }
+
+    void post(function<void()> job)
+    {
+        {
+            // 先计数再入队，都在锁内：工作线程取走任务后才会减，计数不会短暂变成负数
+            lock_guard<mutex> lock(queueMutex);
+            stats.queuedRequests++;
+            jobs.push_back(move(job));
+        }
+        queueCv.notify_one();
+    }
+
+    // 排队深度和线程数，AI 据此缩减每步的思考时间
+    const ServerLoad &load() const
+    {
+        return stats;
+    }
+
+    long long rejected() const
+    {
+        return rejectedCount.load();
+    }
+};
+
+// ========================================
+// MoveRequest - /api/move 请求体的快速解析
+// 请求体固定是 {"gameId":"...","row":r,"col":c[,"moveId":"..."]}，一趟扫描取出字段，
+// 字符串直接指向请求体，不分配内存；出错用返回值表示，不抛异常。
+// 遇到转义字符、小数、嵌套值等少见写法时返回 MOVE_PARSE_FALLBACK，交给 nlohmann 处理
+// ========================================
+enum MoveParseStatus
+{
+    MOVE_PARSE_OK,
+    MOVE_PARSE_MALFORMED, // 不是合法的 JSON
+    MOVE_PARSE_FALLBACK   // 形状不在快速路径之内
+};
+
+struct MoveRequest
+{
+    string_view gameId;
+    string_view moveId;
+    int row = 0;
+    int col = 0;
+    size_t errorOffset = 0; // MOVE_PARSE_MALFORMED 时出错的位置
+
+    MoveParseStatus parse(string_view body)
+    {
+        const char *p = body.data();
+        const char *end = p + body.size();
+        bool hasGameId = false;
+        bool hasRow = false;
+        bool hasCol = false;
+        moveId = string_view();
+
+        skipSpace(p, end);
+        if (p == end || *p != '{')
+            return MOVE_PARSE_FALLBACK; // 不是对象（也可能是合法的其它 JSON 值）
+        p++;
+        skipSpace(p, end);
+        if (p < end && *p == '}')
+            return MOVE_PARSE_FALLBACK; // 空对象：缺字段，沿用 nlohmann 的报错
+
+        while (true)
+        {
+            string_view key;
+            MoveParseStatus status = readString(p, end, key);
+            if (status != MOVE_PARSE_OK)
+                return status == MOVE_PARSE_MALFORMED ? malformed(body, p) : status;
+            skipSpace(p, end);
+            if (p == end || *p != ':')
+                return malformed(body, p);
+            p++;
+            skipSpace(p, end);
+
+            if (key == "gameId" || key == "moveId")
+            {
+                if (p == end || *p != '"')
+                    return MOVE_PARSE_FALLBACK;
+                status = readString(p, end, key == "gameId" ? gameId : moveId);
+                hasGameId = hasGameId || key == "gameId";
+            }
+            else if (key == "row" || key == "col")
+            {
+                status = readInt(p, end, key == "row" ? row : col);
+                hasRow = hasRow || key == "row";
+                hasCol = hasCol || key == "col";
+            }
+            else
+            {
+                status = skipScalar(p, end);
+            }
+            if (status != MOVE_PARSE_OK)
+                return status == MOVE_PARSE_MALFORMED ? malformed(body, p) : status;
+
+            skipSpace(p, end);
+            if (p == end)
+                return malformed(body, p);
+            if (*p == '}')
+                break;
+            if (*p != ',')
+                return malformed(body, p);
+            p++;
+            skipSpace(p, end);
+        }
+
+        p++;
+        skipSpace(p, end);
+        if (p != end)
+            return malformed(body, p);
+        return hasGameId && hasRow && hasCol ? MOVE_PARSE_OK : MOVE_PARSE_FALLBACK;
+    }
+
+private:
+    MoveParseStatus malformed(string_view body, const char *p)
+    {
+        errorOffset = (size_t)(p - body.data());
+        return MOVE_PARSE_MALFORMED;
+    }
+
+    static void skipSpace(const char *&p, const char *end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+            p++;
+    }
+
+    // 不含转义的字符串；含反斜杠时交给 nlohmann
+    static MoveParseStatus readString(const char *&p, const char *end, string_view &out)
+    {
+        if (p == end || *p != '"')
+            return MOVE_PARSE_MALFORMED;
+        const char *start = ++p;
+        while (p < end && *p != '"')
+        {
+            if (*p == '\\')
+                return MOVE_PARSE_FALLBACK;
+            if ((unsigned char)*p < 0x20)
+                return MOVE_PARSE_MALFORMED;
+            p++;
+        }
+        if (p == end)
+            return MOVE_PARSE_MALFORMED;
+        out = string_view(start, (size_t)(p - start));
+        p++;
+        return MOVE_PARSE_OK;
+    }
+
+    // 不超过 9 位的整数；小数、指数或其它类型交给 nlohmann
+    static MoveParseStatus readInt(const char *&p, const char *end, int &out)
+    {
+        bool negative = p < end && *p == '-';
+        if (negative)
+            p++;
+        const char *digits = p;
+        int value = 0;
+        while (p < end && *p >= '0' && *p <= '9')
+        {
+            if (p - digits >= 9)
+                return MOVE_PARSE_FALLBACK;
+            value = value * 10 + (*p - '0');
+            p++;
+        }
+        if (p == digits)
+            return negative ? MOVE_PARSE_MALFORMED : MOVE_PARSE_FALLBACK;
+        if (*digits == '0' && p - digits > 1)
+            return MOVE_PARSE_MALFORMED; // JSON 不允许前导零
+        if (p < end && (*p == '.' || *p == 'e' || *p == 'E'))
+            return MOVE_PARSE_FALLBACK;
+        out = negative ? -value : value;
+        return MOVE_PARSE_OK;
+    }
+
+    // 跳过不认识的键的值，只接受标量
+    static MoveParseStatus skipScalar(const char *&p, const char *end)
+    {
+        if (p == end)
+            return MOVE_PARSE_MALFORMED;
+        if (*p == '"')
+        {
+            string_view ignored;
+            return readString(p, end, ignored);
+        }
+        if (*p == '-' || (*p >= '0' && *p <= '9'))
+        {
+            int ignored;
+            return readInt(p, end, ignored);
+        }
+        static const string_view literals[] = {"true", "false", "null"};
+        for (const string_view &literal : literals)
+        {
+            if ((size_t)(end - p) >= literal.size() && string_view(p, literal.size()) == literal)
+            {
+                p += literal.size();
+                return MOVE_PARSE_OK;
+            }
+        }
+        return *p == '{' || *p == '[' ? MOVE_PARSE_FALLBACK : MOVE_PARSE_MALFORMED;
+    }
+};
+
+// 标准 base64（带 = 填充），结果追加到 out
+inline void base64Append(const uint8_t *data, size_t length, string &out)
+{
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i = 0;
+    for (; i + 3 <= length; i += 3)
+    {
+        uint32_t v = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+        out += table[v >> 18];
+        out += table[(v >> 12) & 63];
+        out += table[(v >> 6) & 63];
+        out += table[v & 63];
+    }
+    if (i < length)
+    {
+        uint32_t v = data[i] << 16;
+        if (i + 1 < length)
+            v |= data[i + 1] << 8;
+        out += table[v >> 18];
+        out += table[(v >> 12) & 63];
+        out += i + 1 < length ? table[(v >> 6) & 63] : '=';
+        out += '=';
+    }
+}
+
+// ========================================
+// JsonWriter - 热点接口的响应序列化
+// 直接把 JSON 文本追加到每个线程复用的缓冲区，不构建 nlohmann::json 的节点树；
+// 请求解析仍然用 nlohmann
+// ========================================
+class JsonWriter
+{
+private:
+    string &out;
+    bool needComma; // 下一个键或数组元素前要补逗号
+
+    static string &threadBuffer()
+    {
+        static thread_local string buffer;
+        return buffer;
+    }
+
+    void separate()
+    {
+        if (needComma)
+            out += ',';
+        needComma = false;
+    }
+
+    template <typename T>
+    void number(T value)
+    {
+        char digits[24];
+        auto result = to_chars(digits, digits + sizeof(digits), value);
+        out.append(digits, result.ptr);
+        needComma = true;
+    }
+
+public:
+    // 清空本线程的缓冲区并开始写；缓冲区的容量保留下来给下一个请求
+    JsonWriter() : out(threadBuffer()), needComma(false)
+    {
+        out.clear();
+    }
+
+    JsonWriter(const JsonWriter &) = delete;
+    JsonWriter &operator=(const JsonWriter &) = delete;
+
+    JsonWriter &beginObject()
+    {
+        separate();
+        out += '{';
+        return *this;
+    }
+
+    JsonWriter &endObject()
+    {
+        out += '}';
+        needComma = true;
+        return *this;
+    }
+
+    JsonWriter &beginArray()
+    {
+        separate();
+        out += '[';
+        return *this;
+    }
+
+    JsonWriter &endArray()
+    {
+        out += ']';
+        needComma = true;
+        return *this;
+    }
+
+    // 写出键名，紧跟的值不再补逗号
+    JsonWriter &key(const char *name)
+    {
+        separate();
+        out += '"';
+        out += name;
+        out += "\":";
+        return *this;
+    }
+
+    JsonWriter &value(int v)
+    {
+        separate();
+        number(v);
+        return *this;
+    }
+
+    JsonWriter &value(long long v)
+    {
+        separate();
+        number(v);
+        return *this;
+    }
+
+    JsonWriter &value(uint64_t v)
+    {
+        separate();
+        number(v);
+        return *this;
+    }
+
+    JsonWriter &value(bool v)
+    {
+        separate();
+        out += v ? "true" : "false";
+        needComma = true;
+        return *this;
+    }
+
+    JsonWriter &value(const char *v)
+    {
+        return value(v, strlen(v));
+    }
+
+    JsonWriter &value(const string &v)
+    {
+        return value(v.data(), v.size());
+    }
+
+    // 字符串值，按 JSON 规则转义引号、反斜杠和控制字符
+    JsonWriter &value(const char *v, size_t length)
+    {
+        static const char hex[] = "0123456789abcdef";
+        separate();
+        out += '"';
+        for (size_t i = 0; i < length; i++)
+        {
+            unsigned char ch = (unsigned char)v[i];
+            if (ch == '"' || ch == '\\')
+            {
+                out += '\\';
+                out += (char)ch;
+            }
+            else if (ch < 0x20)
+            {
+                out += "\\u00";
+                out += hex[ch >> 4];
+                out += hex[ch & 0xF];
+            }
+            else
+            {
+                out += (char)ch;
+            }
+        }
+        out += '"';
+        needComma = true;
+        return *this;
+    }
+
+    JsonWriter &null()
+    {
+        separate();
+        out += "null";
+        needComma = true;
+        return *this;
+    }
+
+    // 二进制数据写成 base64 字符串
+    JsonWriter &base64(const uint8_t *data, size_t length)
+    {
+        separate();
+        out += '"';
+        base64Append(data, length, out);
+        out += '"';
+        needComma = true;
+        return *this;
+    }
+
+    template <typename T>
+    JsonWriter &field(const char *name, const T &v)
+    {
+        return key(name).value(v);
+    }
+
+    // 引用指向本线程的缓冲区，本线程下一次构造 JsonWriter 时就会被清空，需要保留时先复制
+    const string &str() const
+    {
+        return out;
+    }
+
+    // 只有 error / message 两个字段的错误响应；返回副本，不受之后的 JsonWriter 影响
+    static string error(const char *error, const char *message = nullptr)
+    {
+        JsonWriter writer;
+        writer.beginObject().field("error", error);
+        if (message != nullptr)
+            writer.field("message", message);
+        writer.endObject();
+        return writer.str();
+    }
+};
+
+// ========================================
+// GameFlow - 新建对局和落子的流程，HTTP 接口和 WebSocket 通道共用
+// AI 的应手在 AiWorkerPool 里计算，请求线程只负责落下玩家这一步
+// ========================================
+
+// /api/new-game 与 WebSocket new-game 消息的可选参数
+struct NewGameRequest
+{
+    SearchLimits limits;
+    string difficulty = "easy";
+    int gradeSize = 13;
+    uint64_t seed = 0;
+
+    // 可选参数：gradeSize（13/15/19），difficulty（easy/normal/hard），或直接指定 depth / maxNodes / timeMs
+    // seed 指定 AI 的随机种子（复盘用），不传则沿用调用方给的默认值
+    // 参数不合法时返回错误描述；类型不对时由 nlohmann 抛异常
+    const char *read(const json &body)
+    {
+        seed = body.value("seed", seed);
+        gradeSize = body.value("gradeSize", gradeSize);
+        if (!GameSession::isSupportedSize(gradeSize))
+        {
+            return "Unsupported gradeSize";
+        }
+        difficulty = body.value("difficulty", difficulty);
+        if (!SearchLimits::forDifficulty(difficulty, limits))
+        {
+            return "Unknown difficulty";
+        }
+        limits.depth = max(1, min(body.value("depth", limits.depth), 8));
+        limits.maxNodes = body.value("maxNodes", limits.maxNodes);
+        limits.timeBudgetMs = body.value("timeMs", limits.timeBudgetMs);
+        // depth 1 是贪心，不搜索；要搜索时预算不能是 0（不限）或超过服务器上限
+        if (limits.depth > 1)
+        {
+            if (limits.maxNodes <= 0 || limits.maxNodes > SearchLimits::MAX_CLIENT_NODES)
+                limits.maxNodes = SearchLimits::MAX_CLIENT_NODES;
+            if (limits.timeBudgetMs <= 0 || limits.timeBudgetMs > SearchLimits::MAX_CLIENT_TIME_MS)
+                limits.timeBudgetMs = SearchLimits::MAX_CLIENT_TIME_MS;
+        }
+        return nullptr;
+    }
+
+    // 创建会话并设置 AI 的搜索参数
+    shared_ptr<GameSession> start(SessionStore &sessions) const
+    {
+        auto session = sessions.create(gradeSize, seed);
+        {
+            lock_guard<mutex> lock(session->moveMutex);
+            session->visit([&](auto &game) { game.ai.setSearchLimits(limits); });
+        }
+        LOG_INFO("新游戏").kv("gameId", session->gameId).kv("gradeSize", gradeSize).kv("seed", seed)
+            .kv("difficulty", difficulty).kv("depth", limits.depth);
+        return session;
+    }
+
+    // 返回给客户端的字段，不含外层花括号
+    void writeFields(JsonWriter &response, const string &gameId) const
+    {
+        response.field("gameId", gameId)
+            .field("gradeSize", gradeSize)
+            .field("seed", seed)
+            .field("difficulty", difficulty)
+            .field("depth", limits.depth)
+            .field("timeMs", limits.timeBudgetMs);
+    }
+};
+
+// /api/move 的响应：success，之后是 aiMove 和/或 gameOver + winner
+inline void MoveOutcome::writeFields(JsonWriter &response) const
+{
+    response.field("success", true);
+    if (aiMove.row >= 0)
+    {
+        response.key("aiMove").beginObject().field("row", aiMove.row).field("col", aiMove.col).endObject();
+    }
+    if (winner != 0)
+    {
+        response.field("gameOver", true).field("winner", winnerName());
+    }
+}
+
+// 落下玩家这一步（黑棋）并判胜。调用方需持有 session->moveMutex
+template <int N>
+MoveOutcome applyPlayerMove(BoardSession<N> &game, SessionStore &sessions, int row, int col)
+{
+    MoveOutcome outcome;
+    ChessLogic<N> &chess = game.chess;
+
+    if (!chess.chessDown(row, col, CHESS_BLACK))
+    {
+        return outcome;
+    }
+    outcome.valid = true;
+    game.recordMove(row, col, CHESS_BLACK);
+
+    // 检查玩家是否胜利
+    if (chess.checkWin())
+    {
+        outcome.winner = CHESS_BLACK;
+        game.events.publishGameOver(CHESS_BLACK);
+        sessions.retire(game);
+        LOG_INFO("游戏结束").kv("gameId", game.gameId).kv("winner", "black");
+    }
+    return outcome;
+}
+
+// AI 思考并落子（白棋），再判胜，结果补进 outcome。调用方需持有 session->moveMutex
+// 思考时间按 AI 队列的排队深度缩减
+template <int N>
+void replyWithAi(BoardSession<N> &game, SessionStore &sessions, const ServerLoad &load, MoveOutcome &outcome)
+{
+    ChessLogic<N> &chess = game.chess;
+    AILogic<N> &ai = game.ai;
+
+    auto start = chrono::steady_clock::now();
+    int budgetMs = load.effectiveBudgetMs(ai.getSearchLimits().timeBudgetMs);
+    auto deadline = budgetMs > 0 ? start + chrono::milliseconds(budgetMs)
+                                 : chrono::steady_clock::time_point::max();
+    ChessPos aiPos = ai.go(deadline);
+    auto thinkTime = chrono::steady_clock::now() - start;
+    long long thinkMs = chrono::duration_cast<chrono::milliseconds>(thinkTime).count();
+    ServerMetrics::instance().aiThink.record(thinkTime);
+    if (aiPos.row < 0 || aiPos.col < 0)
+    {
+        return;
+    }
+
+    chess.chessDown(aiPos.row, aiPos.col, CHESS_WHITE);
+    outcome.aiMove = aiPos;
+    game.recordMove(aiPos.row, aiPos.col, CHESS_WHITE);
+    LOG_INFO("AI落子").kv("gameId", game.gameId).kv("pos", aiPos).kv("depth", ai.getCompletedDepth())
+        .kv("nodes", ai.getNodeCount()).kv("thinkMs", thinkMs);
+
+    // 检查AI是否胜利
+    if (chess.checkWin())
+    {
+        outcome.winner = CHESS_WHITE;
+        game.events.publishGameOver(CHESS_WHITE);
+        sessions.retire(game);
+        LOG_INFO("游戏结束").kv("gameId", game.gameId).kv("winner", "white");
+    }
+}
+
+// 一步落子的完整流程：请求线程落下玩家这一步，AI 应手交给 AiWorkerPool，结果通过 AiTicket 取回
+class MoveService
+{
+public:
+    enum Status
+    {
+        MOVE_INVALID,  // 落不下去：越界或已有棋子
+        MOVE_OVER,     // 对局已分出胜负，不再接受落子
+        MOVE_BUSY,     // AI 队列已满，这一步没有落下
+        MOVE_THINKING, // AI 还在算上一步，这一步没有落下
+        MOVE_DONE,     // 已有最终结果（玩家直接获胜，或重复请求），见 outcome
+        MOVE_QUEUED    // 玩家这一步已落下，AI 应手见 ticket
+    };
+
+private:
+    SessionStore &sessions;
+    AiWorkerPool &aiPool;
+
+    // 有未完成的 ticket 时，同一 moveId 的重试拿到同一张 ticket，其他落子返回 MOVE_THINKING
+    static bool pendingTicket(GameSession &session, const string &moveId, shared_ptr<AiTicket> &ticket,
+                              Status &status)
+    {
+        lock_guard<mutex> lock(session.ticketMutex);
+        if (!session.aiTicket || session.aiTicket->isDone())
+            return false;
+        if (!moveId.empty() && moveId == session.aiTicket->moveId)
+        {
+            ticket = session.aiTicket;
+            status = MOVE_QUEUED;
+        }
+        else
+        {
+            status = MOVE_THINKING;
+        }
+        return true;
+    }
+
+    void think(const shared_ptr<GameSession> &session, const shared_ptr<AiTicket> &ticket)
+    {
+        {
+            lock_guard<mutex> lock(session->moveMutex);
+            MoveOutcome outcome;
+            outcome.valid = true;
+            session->visit([&](auto &game) { replyWithAi(game, sessions, aiPool.load(), outcome); });
+            session->lastMoveId = ticket->moveId;
+            session->lastOutcome = outcome;
+            ticket->complete(outcome);
+        }
+        ticket->runCallbacks();
+    }
+
+public:
+    MoveService(SessionStore &sessions, AiWorkerPool &aiPool) : sessions(sessions), aiPool(aiPool) {}
+
+    Status submit(const shared_ptr<GameSession> &session, int row, int col, const string &moveId,
+                  MoveOutcome &outcome, shared_ptr<AiTicket> &ticket)
+    {
+        // 先不拿 moveMutex 看一眼：AI 正在搜索时直接返回，请求线程不会卡在搜索上
+        Status status;
+        if (pendingTicket(*session, moveId, ticket, status))
+            return status;
+
+        lock_guard<mutex> lock(session->moveMutex);
+        // ticket 在 moveMutex 内创建和完成，这里再确认一次
+        if (pendingTicket(*session, moveId, ticket, status))
+            return status;
+
+        // 重试的请求（moveId 与上一步相同）直接返回上次的结果，不再重新计算
+        if (!moveId.empty() && moveId == session->lastMoveId)
+        {
+            LOG_INFO("重复请求").kv("gameId", session->gameId).kv("moveId", moveId);
+            outcome = session->lastOutcome;
+            return MOVE_DONE;
+        }
+
+        // retire() 也在 moveMutex 内调用，这里看到的 finished 是准确的
+        if (session->finished.load(memory_order_relaxed))
+            return MOVE_OVER;
+
+        if (!aiPool.tryReserve())
+            return MOVE_BUSY;
+
+        int moveCount = 0;
+        session->visit([&](auto &game) {
+            outcome = applyPlayerMove(game, sessions, row, col);
+            moveCount = game.chess.getMoveCount();
+        });
+        if (!outcome.valid || outcome.winner != 0)
+        {
+            aiPool.cancelReservation();
+            if (!outcome.valid)
+                return MOVE_INVALID;
+            session->lastMoveId = moveId;
+            session->lastOutcome = outcome;
+            return MOVE_DONE;
+        }
+
+        ticket = make_shared<AiTicket>(moveCount, moveId);
+        {
+            lock_guard<mutex> ticketLock(session->ticketMutex);
+            session->aiTicket = ticket;
+        }
+        aiPool.post([this, session, ticket]() { think(session, ticket); });
+        return MOVE_QUEUED;
+    }
+
+    // 按编号取本局的 ticket，编号对不上时返回空
+    static shared_ptr<AiTicket> findTicket(GameSession &session, int number)
+    {
+        lock_guard<mutex> lock(session.ticketMutex);
+        if (!session.aiTicket || session.aiTicket->number != number)
+            return nullptr;
+        return session.aiTicket;
+    }
+};
+
+// ========================================
+// Sha1 - WebSocket 握手用的 SHA-1（RFC 3174）
+// 每条连接只对几十字节算一次，按规范逐块处理即可
+// ========================================
+class Sha1
+{
+private:
+    static uint32_t rotl(uint32_t x, int n)
+    {
+        return (x << n) | (x >> (32 - n));
+    }
+
+public:
+    static array<uint8_t, 20> digest(string_view data)
+    {
+        uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+        // 补位：0x80，若干 0，最后 8 字节是大端的比特长度
+        string message(data);
+        uint64_t bitLength = (uint64_t)data.size() * 8;
+        message += (char)0x80;
+        while (message.size() % 64 != 56)
+        {
+            message += '\0';
+        }
+        for (int i = 7; i >= 0; i--)
+        {
+            message += (char)(bitLength >> (i * 8));
+        }
+
+        for (size_t block = 0; block < message.size(); block += 64)
+        {
+            const uint8_t *p = (const uint8_t *)message.data() + block;
+            uint32_t w[80];
+            for (int i = 0; i < 16; i++)
+            {
+                w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+            }
+            for (int i = 16; i < 80; i++)
+            {
+                w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+            }
+
+            uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+            for (int i = 0; i < 80; i++)
+            {
+                uint32_t f, k;
+                if (i < 20)
+                {
+                    f = (b & c) | (~b & d);
+                    k = 0x5A827999;
+                }
+                else if (i < 40)
+                {
+                    f = b ^ c ^ d;
+                    k = 0x6ED9EBA1;
+                }
+                else if (i < 60)
+                {
+                    f = (b & c) | (b & d) | (c & d);
+                    k = 0x8F1BBCDC;
+                }
+                else
+                {
+                    f = b ^ c ^ d;
+                    k = 0xCA62C1D6;
+                }
+                uint32_t t = rotl(a, 5) + f + e + k + w[i];
+                e = d;
+                d = c;
+                c = rotl(b, 30);
+                b = a;
+                a = t;
+            }
+            h[0] += a;
+            h[1] += b;
+            h[2] += c;
+            h[3] += d;
+            h[4] += e;
+        }
+
+        array<uint8_t, 20> out;
+        for (int i = 0; i < 5; i++)
+        {
+            out[4 * i] = (uint8_t)(h[i] >> 24);
+            out[4 * i + 1] = (uint8_t)(h[i] >> 16);
+            out[4 * i + 2] = (uint8_t)(h[i] >> 8);
+            out[4 * i + 3] = (uint8_t)h[i];
+        }
+        return out;
+    }
+};
+
+// ========================================
+// WebSocketServer - /ws/game 对局通道（RFC 6455 的最小实现）
+// httplib 不支持 WebSocket，这里单独监听一个端口（默认 8889）。一条连接绑定一局：
+//   客户端 {"type":"new-game", ...同 /api/new-game 的参数}  或  {"type":"join","gameId":"..."}
+//   之后每步只发 {"type":"move","row":r,"col":c}
+//   服务器先回 {"type":"moved",...} 确认玩家这一步，AI 算完立即推送 {"type":"aiMove",...}
+// 省掉每步的 HTTP 请求头、gameId 查找和 CORS 预检。每条连接一个线程，阻塞读写，连接数有上限
+// ========================================
+class WebSocketServer
+{
+private:
+    static constexpr size_t MAX_HANDSHAKE_BYTES = 8192;
+    static constexpr size_t MAX_MESSAGE_BYTES = 4096; // 对局消息都只有几十字节
+    static constexpr size_t THREAD_STACK_BYTES = 256 * 1024; // 连接线程只解析几 KB 的消息，不需要默认的 8MB 栈
+    static constexpr size_t MAX_OUTPUT_BYTES = 64 * 1024;    // 每条连接最多积压的待发字节
+    static constexpr int CLOSE_DRAIN_MS = 1000;              // 断开前等 close 帧写出的时间
+
+    enum Opcode
+    {
+        OP_CONTINUATION = 0x0,
+        OP_TEXT = 0x1,
+        OP_BINARY = 0x2,
+        OP_CLOSE = 0x8,
+        OP_PING = 0x9,
+        OP_PONG = 0xA
+    };
+
+    // 关闭帧的状态码
+    enum CloseCode
+    {
+        CLOSE_NORMAL = 1000,
+        CLOSE_GOING_AWAY = 1001,
+        CLOSE_PROTOCOL_ERROR = 1002,
+        CLOSE_UNSUPPORTED = 1003,
+        CLOSE_TOO_BIG = 1009
+    };
+
+    // 一条连接：带读缓冲的帧收发
+    // 读只在连接线程里进行；写还可能来自推送 AI 应手的 AI 线程，由 writeMutex 串行化。
+    // 写一律不阻塞：发不完的部分留在 output 里，由连接线程在 poll 到 POLLOUT 时接着发，
+    // 对方长期不读、积压超过 MAX_OUTPUT_BYTES 就断开，AI 线程不会被慢客户端卡住
+    class Connection : public enable_shared_from_this<Connection>
+    {
+    private:
+        int fd;
+        int wakeFd;      // 其他线程留下待发数据时唤醒 poll，让连接线程加上 POLLOUT
+        int idleMs;      // 这么久既读不到也写不出就断开
+        string input;
+        size_t readPos;
+        mutex writeMutex;
+        string output;   // 还没写进内核的字节，受 writeMutex 保护
+        bool writable;   // 连接线程退出或积压过多后置为 false，迟到的推送不再写这个 fd
+
+        // 在 writeMutex 内调用：尽量把 output 写进内核，遇到 EAGAIN 就停；连接已坏返回 false
+        bool flushLocked()
+        {
+            size_t sent = 0;
+            while (sent < output.size())
+            {
+                ssize_t n = ::send(fd, output.data() + sent, output.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    break;
+                if (n <= 0)
+                {
+                    output.clear();
+                    return false;
+                }
+                sent += (size_t)n;
+            }
+            output.erase(0, sent);
+            return true;
+        }
+
+        // 写不下去的连接：不再接受新数据，并唤醒阻塞在 poll 上的连接线程让它退出
+        void breakLocked()
+        {
+            writable = false;
+            output.clear();
+            shutdown(fd, SHUT_RDWR);
+        }
+
+        // 等到可读，期间把积压的输出写出去；超时或出错返回 false
+        bool waitReadable()
+        {
+            while (true)
+            {
+                bool pending;
+                {
+                    lock_guard<mutex> lock(writeMutex);
+                    pending = !output.empty();
+                }
+                pollfd fds[2] = {{fd, (short)(POLLIN | (pending ? POLLOUT : 0)), 0}, {wakeFd, POLLIN, 0}};
+                int ready = poll(fds, 2, idleMs > 0 ? idleMs : -1);
+                if (ready < 0 && errno == EINTR)
+                    continue;
+                if (ready <= 0)
+                    return false;
+                if (fds[1].revents & POLLIN)
+                {
+                    uint64_t count;
+                    while (::read(wakeFd, &count, sizeof(count)) > 0)
+                    {
+                    }
+                }
+                if (fds[0].revents & POLLOUT)
+                {
+                    lock_guard<mutex> lock(writeMutex);
+                    if (writable && !flushLocked())
+                        breakLocked();
+                }
+                if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
+                    return true;
+            }
+        }
+
+        // 保证缓冲区里至少有 n 个未读字节
+        bool fill(size_t n)
+        {
+            while (input.size() - readPos < n)
+            {
+                char chunk[4096];
+                ssize_t got = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+                if (got < 0 && errno == EINTR)
+                    continue;
+                if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                {
+                    if (!waitReadable())
+                        return false;
+                    continue;
+                }
+                if (got <= 0)
+                    return false;
+                input.append(chunk, (size_t)got);
+            }
+            return true;
+        }
+
+        void consume(size_t n)
+        {
+            readPos += n;
+            if (readPos == input.size())
+            {
+                input.clear();
+                readPos = 0;
+            }
+        }
+
+        const uint8_t *unread() const
+        {
+            return (const uint8_t *)input.data() + readPos;
+        }
+
+    public:
+        Connection(int fd, int idleSeconds)
+            : fd(fd), wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), idleMs(idleSeconds * 1000), readPos(0),
+              writable(true)
+        {
+        }
+
+        ~Connection()
+        {
+            if (wakeFd >= 0)
+                close(wakeFd);
+        }
+
+        Connection(const Connection &) = delete;
+        Connection &operator=(const Connection &) = delete;
+
+        // 排进输出队列并尽量立即写出，从不阻塞；连接已断开或积压过多时返回 false
+        bool writeAll(string_view data)
+        {
+            lock_guard<mutex> lock(writeMutex);
+            if (!writable)
+                return false;
+            output.append(data.data(), data.size());
+            if (!flushLocked())
+            {
+                writable = false;
+                return false;
+            }
+            if (output.empty())
+                return true;
+            if (output.size() > MAX_OUTPUT_BYTES)
+            {
+                breakLocked();
+                return false;
+            }
+            uint64_t one = 1;
+            ssize_t ignored = ::write(wakeFd, &one, sizeof(one));
+            (void)ignored;
+            return true;
+        }
+
+        // 关闭前最多等 timeoutMs 把积压的输出（通常是 close 帧）写完
+        void drain(int timeoutMs)
+        {
+            auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutMs);
+            unique_lock<mutex> lock(writeMutex);
+            while (writable && !output.empty())
+            {
+                auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+                if (left <= 0)
+                    return;
+                lock.unlock();
+                pollfd pfd{fd, POLLOUT, 0};
+                int ready = poll(&pfd, 1, (int)left);
+                lock.lock();
+                if (ready < 0 && errno != EINTR)
+                    return;
+                if (ready > 0 && writable && !flushLocked())
+                    return;
+            }
+        }
+
+        // 读到空行为止的 HTTP 请求头
+        bool readRequestHead(string &head)
+        {
+            size_t end;
+            while ((end = input.find("\r\n\r\n", readPos)) == string::npos)
+            {
+                if (input.size() - readPos > MAX_HANDSHAKE_BYTES || !fill(input.size() - readPos + 1))
+                    return false;
+            }
+            head.assign(input, readPos, end + 4 - readPos);
+            consume(end + 4 - readPos);
+            return true;
+        }
+
+        // 服务器发出的帧不加掩码
+        bool send(int opcode, string_view payload)
+        {
+            string frame;
+            frame.reserve(payload.size() + 10);
+            frame += (char)(0x80 | opcode);
+            if (payload.size() < 126)
+            {
+                frame += (char)payload.size();
+            }
+            else if (payload.size() <= 0xFFFF)
+            {
+                frame += (char)126;
+                frame += (char)(payload.size() >> 8);
+                frame += (char)(payload.size() & 0xFF);
+            }
+            else
+            {
+                frame += (char)127;
+                for (int i = 7; i >= 0; i--)
+                    frame += (char)((uint64_t)payload.size() >> (i * 8));
+            }
+            frame.append(payload.data(), payload.size());
+            return writeAll(frame);
+        }
+
+        // 连接线程退出前调用，之后 fd 可能被关闭并复用
+        void detach()
+        {
+            lock_guard<mutex> lock(writeMutex);
+            writable = false;
+        }
+
+        void sendClose(int code)
+        {
+            char payload[2] = {(char)(code >> 8), (char)(code & 0xFF)};
+            send(OP_CLOSE, string_view(payload, 2));
+        }
+
+        // 读一条完整的文本消息，分片会拼接起来；ping 直接回 pong
+        // 收到 close、协议错误或连接断开时返回 false
+        bool readMessage(string &message)
+        {
+            message.clear();
+            int messageOpcode = -1;
+            while (true)
+            {
+                if (!fill(2))
+                    return false;
+                const uint8_t *p = unread();
+                bool fin = (p[0] & 0x80) != 0;
+                int opcode = p[0] & 0x0F;
+                bool masked = (p[1] & 0x80) != 0;
+                uint64_t length = p[1] & 0x7F;
+
+                // 客户端的帧必须加掩码，且不使用任何扩展位
+                if ((p[0] & 0x70) != 0 || !masked)
+                {
+                    sendClose(CLOSE_PROTOCOL_ERROR);
+                    return false;
+                }
+
+                size_t headerBytes = 2 + (length == 126 ? 2 : length == 127 ? 8 : 0) + 4;
+                if (!fill(headerBytes))
+                    return false;
+                p = unread();
+                if (length == 126)
+                {
+                    length = (uint64_t)p[2] << 8 | p[3];
+                }
+                else if (length == 127)
+                {
+                    length = 0;
+                    for (int i = 0; i < 8; i++)
+                        length = length << 8 | p[2 + i];
+                }
+                // 控制帧（close / ping / pong）不能分片，负载最多 125 字节
+                if ((opcode & 0x8) != 0 && (!fin || length > 125))
+                {
+                    sendClose(CLOSE_PROTOCOL_ERROR);
+                    return false;
+                }
+                if (length > MAX_MESSAGE_BYTES || message.size() + length > MAX_MESSAGE_BYTES)
+                {
+                    sendClose(CLOSE_TOO_BIG);
+                    return false;
+                }
+
+                if (!fill(headerBytes + length))
+                    return false;
+                p = unread();
+                const uint8_t *mask = p + headerBytes - 4;
+                string payload((const char *)p + headerBytes, (size_t)length);
+                for (size_t i = 0; i < payload.size(); i++)
+                    payload[i] ^= mask[i & 3];
+                consume(headerBytes + length);
+
+                switch (opcode)
+                {
+                case OP_PING:
+                    if (!send(OP_PONG, payload))
+                        return false;
+                    continue;
+                case OP_PONG:
+                    continue;
+                case OP_CLOSE:
+                    // 按规范回一个 close，带回对方的状态码
+                    send(OP_CLOSE, string_view(payload).substr(0, 2));
+                    return false;
+                case OP_TEXT:
+                case OP_BINARY:
+                    if (messageOpcode >= 0)
+                    {
+                        sendClose(CLOSE_PROTOCOL_ERROR);
+                        return false;
+                    }
+                    messageOpcode = opcode;
+                    message = move(payload);
+                    break;
+                case OP_CONTINUATION:
+                    if (messageOpcode < 0)
+                    {
+                        sendClose(CLOSE_PROTOCOL_ERROR);
+                        return false;
+                    }
+                    message += payload;
+                    break;
+                default:
+                    sendClose(CLOSE_PROTOCOL_ERROR);
+                    return false;
+                }
+
+                if (fin)
+                {
+                    if (messageOpcode == OP_BINARY)
+                    {
+                        sendClose(CLOSE_UNSUPPORTED);
+                        return false;
+                    }
+                    return true;
+                }
+            }
+        }
+    };
+
+    SessionStore &sessions;
+    MoveService &moves;
+    int maxConnections;
+    int idleSeconds;
+
+    int listenFd;
+    atomic<bool> running;
+    thread acceptThread;
+    atomic<long long> rejectedCount; // 因连接数已满被拒绝的握手
+
+    // 活动连接的 fd；停止时逐个 shutdown 唤醒阻塞的读，等所有连接线程退出
+    mutex connectionsMutex;
+    condition_variable connectionsDone;
+    unordered_set<int> connections;
+
+    // 请求头里的字段值，名字不区分大小写
+    static string headerValue(const string &head, const char *name)
+    {
+        size_t nameLength = strlen(name);
+        size_t lineStart = head.find("\r\n");
+        while (lineStart != string::npos)
+        {
+            lineStart += 2;
+            size_t lineEnd = head.find("\r\n", lineStart);
+            if (lineEnd == string::npos || lineEnd == lineStart)
+                break;
+            if (lineEnd - lineStart > nameLength && head[lineStart + nameLength] == ':' &&
+                strncasecmp(head.data() + lineStart, name, nameLength) == 0)
+            {
+                size_t begin = lineStart + nameLength + 1;
+                while (begin < lineEnd && (head[begin] == ' ' || head[begin] == '\t'))
+                    begin++;
+                size_t end = lineEnd;
+                while (end > begin && (head[end - 1] == ' ' || head[end - 1] == '\t'))
+                    end--;
+                return head.substr(begin, end - begin);
+            }
+            lineStart = lineEnd;
+        }
+        return "";
+    }
+
+    static bool containsToken(string value, const char *token)
+    {
+        transform(value.begin(), value.end(), value.begin(), [](unsigned char ch) { return (char)tolower(ch); });
+        return value.find(token) != string::npos;
+    }
+
+    static void reject(Connection &conn, const char *status, const char *extraHeaders = "")
+    {
+        string response = string("HTTP/1.1 ") + status + "\r\n" + extraHeaders +
+                          "Content-Length: 0\r\nConnection: close\r\n\r\n";
+        conn.writeAll(response);
+    }
+
+    // 校验升级请求并回 101
+    static bool handshake(Connection &conn)
+    {
+        string head;
+        if (!conn.readRequestHead(head))
+            return false;
+
+        // 请求行：GET /ws/game HTTP/1.1，允许带查询串
+        string requestLine = head.substr(0, head.find("\r\n"));
+        if (requestLine.compare(0, 4, "GET ") != 0)
+        {
+            reject(conn, "405 Method Not Allowed", "Allow: GET\r\n");
+            return false;
+        }
+        size_t targetEnd = requestLine.find(' ', 4);
+        string path = requestLine.substr(4, targetEnd == string::npos ? string::npos : targetEnd - 4);
+        path = path.substr(0, path.find('?'));
+        if (path != "/ws/game")
+        {
+            reject(conn, "404 Not Found");
+            return false;
+        }
+
+        string key = headerValue(head, "Sec-WebSocket-Key");
+        if (!containsToken(headerValue(head, "Upgrade"), "websocket") ||
+            !containsToken(headerValue(head, "Connection"), "upgrade") || key.empty())
+        {
+            reject(conn, "400 Bad Request");
+            return false;
+        }
+        if (headerValue(head, "Sec-WebSocket-Version") != "13")
+        {
+            reject(conn, "426 Upgrade Required", "Sec-WebSocket-Version: 13\r\n");
+            return false;
+        }
+
+        array<uint8_t, 20> digest = Sha1::digest(key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
+        string response = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                          "Sec-WebSocket-Accept: ";
+        base64Append(digest.data(), digest.size(), response);
+        response += "\r\n\r\n";
+        return conn.writeAll(response);
+    }
+
+    static void sendError(Connection &conn, const char *error, const char *message = nullptr)
+    {
+        JsonWriter writer;
+        writer.beginObject().field("type", "error").field("error", error);
+        if (message != nullptr)
+            writer.field("message", message);
+        writer.endObject();
+        conn.send(OP_TEXT, writer.str());
+    }
+
+    void handleNewGame(Connection &conn, shared_ptr<GameSession> &session, const json &body)
+    {
+        NewGameRequest request;
+        request.seed = sessions.nextSeed();
+        if (const char *error = request.read(body))
+        {
+            sendError(conn, error);
+            return;
+        }
+        session = request.start(sessions);
+
+        JsonWriter response;
+        response.beginObject().field("type", "game");
+        request.writeFields(response, session->gameId);
+        response.endObject();
+        conn.send(OP_TEXT, response.str());
+    }
+
+    // 接上一局已有的对局（例如先用 HTTP 建的局，或断线重连）
+    void handleJoin(Connection &conn, shared_ptr<GameSession> &session, const json &body)
+    {
+        string gameId = body.at("gameId");
+        auto found = sessions.find(gameId);
+        if (!found)
+        {
+            sendError(conn, "Game not found");
+            return;
+        }
+        session = found;
+
+        // 只在锁内拼好消息；发送可能阻塞，不能拿着 snapshotMutex（落子时 recordMove 要在 moveMutex 内拿它）
+        string message;
+        {
+            lock_guard<mutex> lock(session->snapshotMutex);
+            session->visit([&](auto &game) {
+                const auto &chess = game.snapshot;
+                ChessPos last = chess.getLastPos();
+                JsonWriter response;
+                response.beginObject()
+                    .field("type", "joined")
+                    .field("gameId", game.gameId)
+                    .field("gradeSize", chess.getGradeSize())
+                    .field("moveCount", chess.getMoveCount())
+                    .key("lastMove");
+                if (last.row >= 0)
+                    response.beginObject().field("row", last.row).field("col", last.col).endObject();
+                else
+                    response.null();
+                response.endObject();
+                message = response.str();
+            });
+        }
+        conn.send(OP_TEXT, message);
+    }
+
+    static void sendResult(Connection &conn, const char *type, int row, int col, int winner)
+    {
+        JsonWriter response;
+        response.beginObject().field("type", type).field("row", row).field("col", col);
+        if (winner != 0)
+            response.field("gameOver", true).field("winner", winner == CHESS_BLACK ? "black" : "white");
+        response.endObject();
+        conn.send(OP_TEXT, response.str());
+    }
+
+    // AI 的应手；棋盘已满、AI 无处可下时 row/col 为 null，客户端据此结束等待
+    static void sendAiMove(Connection &conn, const MoveOutcome &outcome)
+    {
+        if (outcome.aiMove.row >= 0)
+        {
+            sendResult(conn, "aiMove", outcome.aiMove.row, outcome.aiMove.col, outcome.winner);
+            return;
+        }
+        JsonWriter response;
+        response.beginObject().field("type", "aiMove").key("row").null().key("col").null().endObject();
+        conn.send(OP_TEXT, response.str());
+    }
+
+    void handleMove(Connection &conn, shared_ptr<GameSession> &session, const json &body)
+    {
+        if (!session)
+        {
+            sendError(conn, "No game bound to this connection");
+            return;
+        }
+        int row = body.at("row");
+        int col = body.at("col");
+        // 和 /api/move 一样，断线重发同一 moveId 不会落两次子
+        string moveId = body.value("moveId", "");
+        LOG_INFO("玩家落子").kv("gameId", session->gameId).kv("pos", ChessPos(row, col)).kv("via", "ws");
+
+        session->touch();
+        MoveOutcome outcome;
+        shared_ptr<AiTicket> ticket;
+        switch (moves.submit(session, row, col, moveId, outcome, ticket))
+        {
+        case MoveService::MOVE_INVALID:
+            sendError(conn, "Invalid move");
+            return;
+        case MoveService::MOVE_OVER:
+            sendError(conn, "Game over");
+            return;
+        case MoveService::MOVE_BUSY:
+            sendError(conn, "Server busy");
+            return;
+        case MoveService::MOVE_THINKING:
+            sendError(conn, "AI is thinking");
+            return;
+        case MoveService::MOVE_DONE:
+            // 玩家直接获胜，或重发的 moveId 对应的那一步已经算完
+            if (outcome.winner != 0 && outcome.aiMove.row < 0)
+            {
+                sendResult(conn, "moved", row, col, outcome.winner);
+                return;
+            }
+            sendResult(conn, "moved", row, col, 0);
+            sendAiMove(conn, outcome);
+            return;
+        case MoveService::MOVE_QUEUED:
+            break;
+        }
+
+        // 玩家这一步先确认，AI 思考期间客户端就能把棋子画出来；应手由 AI 线程算完后推送，
+        // 连接线程继续读帧（ping、close），不在这里等。推送只是排进输出队列，不会阻塞 AI 线程
+        sendResult(conn, "moved", row, col, 0);
+        shared_ptr<Connection> self = conn.shared_from_this();
+        ticket->onComplete([self](const MoveOutcome &result) { sendAiMove(*self, result); });
+    }
+
+    void handleMessage(Connection &conn, shared_ptr<GameSession> &session, const string &message)
+    {
+        json body = json::parse(message, nullptr, false);
+        if (body.is_discarded() || !body.is_object())
+        {
+            sendError(conn, "Invalid request", "message is not a JSON object");
+            return;
+        }
+        try
+        {
+            string type = body.value("type", "");
+            if (type == "move")
+                handleMove(conn, session, body);
+            else if (type == "new-game")
+                handleNewGame(conn, session, body);
+            else if (type == "join")
+                handleJoin(conn, session, body);
+            else
+                sendError(conn, "Unknown message type");
+        }
+        catch (const exception &e)
+        {
+            sendError(conn, "Invalid request", e.what());
+        }
+    }
+
+    void serve(int fd)
+    {
+        auto conn = make_shared<Connection>(fd, idleSeconds);
+        if (handshake(*conn))
+        {
+            shared_ptr<GameSession> session; // 本连接绑定的对局
+            string message;
+            while (conn->readMessage(message))
+            {
+                handleMessage(*conn, session, message);
+            }
+            if (!running)
+                conn->sendClose(CLOSE_GOING_AWAY);
+        }
+        conn->drain(CLOSE_DRAIN_MS);
+        // 还没推送的 AI 应手可能持有 conn，关闭 fd 之前先让它失效
+        conn->detach();
+
+        // 在锁内关闭，stop() 遍历时不会碰到已被复用的 fd
+        lock_guard<mutex> lock(connectionsMutex);
+        close(fd);
+        connections.erase(fd);
+        connectionsDone.notify_all();
+    }
+
+    void acceptLoop()
+    {
+        while (running)
+        {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                break; // stop() 关闭了监听套接字
+            }
+
+            // 闲置超时由 Connection 的 poll 负责：长时间没有任何帧（包括 ping）就断开，和会话的闲置回收时间一致
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+            {
+                lock_guard<mutex> lock(connectionsMutex);
+                if ((int)connections.size() >= maxConnections || !running)
+                {
+                    rejectedCount++;
+                    Connection conn(fd, 0);
+                    reject(conn, "503 Service Unavailable");
+                    close(fd);
+                    continue;
+                }
+                connections.insert(fd);
+            }
+            if (!spawnConnectionThread(fd))
+            {
+                lock_guard<mutex> lock(connectionsMutex);
+                close(fd);
+                connections.erase(fd);
+                connectionsDone.notify_all();
+            }
+        }
+    }
+
+    struct ServeArgs
+    {
+        WebSocketServer *server;
+        int fd;
+    };
+
+    static void *serveThread(void *arg)
+    {
+        unique_ptr<ServeArgs> args((ServeArgs *)arg);
+        args->server->serve(args->fd);
+        return nullptr;
+    }
+
+    // std::thread 不能指定栈大小，连接线程用 pthread 创建，每条空闲连接只占 THREAD_STACK_BYTES 的栈
+    bool spawnConnectionThread(int fd)
+    {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, THREAD_STACK_BYTES);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        pthread_t tid;
+        auto *args = new ServeArgs{this, fd};
+        bool ok = pthread_create(&tid, &attr, &WebSocketServer::serveThread, args) == 0;
+        pthread_attr_destroy(&attr);
+        if (!ok)
+            delete args;
+        return ok;
+    }
+
+public:
+    WebSocketServer(SessionStore &sessions, MoveService &moves, int maxConnections, int idleSeconds)
+        : sessions(sessions), moves(moves), maxConnections(maxConnections), idleSeconds(idleSeconds),
+          listenFd(-1), running(false), rejectedCount(0)
+    {
+    }
+
+    ~WebSocketServer()
+    {
+        stop();
+    }
+
+    bool start(const char *host, int port)
+    {
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listenFd < 0)
+            return false;
+        int one = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)port);
+        if (inet_pton(AF_INET, host, &addr.sin_addr) != 1 ||
+            ::bind(listenFd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenFd, SOMAXCONN) != 0)
+        {
+            close(listenFd);
+            listenFd = -1;
+            return false;
+        }
+
+        running = true;
+        acceptThread = thread(&WebSocketServer::acceptLoop, this);
+        return true;
+    }
+
+    void stop()
+    {
+        if (!running.exchange(false))
+            return;
+        shutdown(listenFd, SHUT_RDWR);
+        acceptThread.join();
+        close(listenFd);
+        listenFd = -1;
+
+        // 唤醒阻塞在 recv 上的连接线程，等它们全部退出
+        unique_lock<mutex> lock(connectionsMutex);
+        for (int fd : connections)
+            shutdown(fd, SHUT_RD);
+        connectionsDone.wait(lock, [this] { return connections.empty(); });
+    }
+
+    int connectionCount()
+    {
+        lock_guard<mutex> lock(connectionsMutex);
+        return (int)connections.size();
+    }
+
+    long long rejected() const
+    {
+        return rejectedCount.load();
+    }
+
+    int connectionLimit() const
+    {
+        return maxConnections;
+    }
+};
+
+// ========================================
+// EventSubscription - 一条 SSE 事件流：订阅的对局、读到第几个事件、占用的名额
+// 事件流接口只校验参数、占名额，写出由前端负责，与处理请求的线程池无关
+// ========================================
+struct EventSubscription
+{
+    static constexpr int KEEP_ALIVE_SECONDS = 15; // 这么久没有事件时发一行注释保活
+
+    shared_ptr<GameSession> session;
+    size_t cursor = 0;
+    shared_ptr<void> slot; // 最后一份拷贝析构时归还名额
+
+    // 取出 cursor 之后的事件追加到 out，暂时没有时最多等待 timeout
+    // 返回 false 表示事件流已关闭且全部读完
+    bool take(string &out, chrono::milliseconds timeout)
+    {
+        vector<shared_ptr<const string>> frames;
+        bool open = session->events.read(cursor, frames, timeout);
+        for (const auto &frame : frames)
+            out += *frame;
+        return open;
+    }
+
+    // 在当前线程里用分块响应写出（httplib 拿不到套接字，只能这样）。
+    // 每秒醒一次，让 httplib 有机会检查服务器是否在停止
+    static void writeOnThread(httplib::Response &res, EventSubscription subscription)
+    {
+        res.set_chunked_content_provider("text/event-stream",
+            [subscription, quietSeconds = 0](size_t, httplib::DataSink &sink) mutable {
+                string batch;
+                bool open = subscription.take(batch, chrono::seconds(1));
+                if (!batch.empty() && !sink.write(batch.data(), batch.size()))
+                    return false;
+                if (!open) {
+                    sink.done();
+                    return true;
+                }
+                quietSeconds = batch.empty() ? quietSeconds + 1 : 0;
+                if (quietSeconds >= KEEP_ALIVE_SECONDS) {
+                    quietSeconds = 0;
+                    static const char keepAlive[] = ": keep-alive\n\n";
+                    return sink.write(keepAlive, sizeof(keepAlive) - 1);
+                }
+                return true;
+            });
+    }
+};
+
+// ========================================
+// ApiRouter - 接口路由表
+// 同一组处理函数既注册到 httplib::Server，也供 EpollFrontend 直接调用。
+// 路径写法与 httplib 相同：":name" 匹配一段并记入 path_params，结尾的 ".*" 匹配任意后缀
+// ========================================
+class ApiRouter
+{
+public:
+    using Handler = httplib::Server::Handler;
+    // 事件流接口：返回 true 表示开始推送 subscription，false 表示 res 里已经是普通响应（出错）
+    using StreamHandler = function<bool(const httplib::Request &, httplib::Response &, EventSubscription &)>;
+
+    struct Route
+    {
+        string method;
+        string pattern;
+        Handler handler;      // 普通接口
+        StreamHandler stream; // 事件流接口，二者只有一个非空
+    };
+
+private:
+    vector<Route> routes;
+
+    static bool matchPattern(const string &pattern, const string &path,
+                             unordered_map<string, string> &pathParams)
+    {
+        if (pattern.size() >= 2 && pattern.compare(pattern.size() - 2, 2, ".*") == 0)
+        {
+            return path.compare(0, pattern.size() - 2, pattern, 0, pattern.size() - 2) == 0;
+        }
+        size_t p = 0, q = 0;
+        while (p < pattern.size() && q < path.size())
+        {
+            if (pattern[p] == ':')
+            {
+                size_t nameEnd = min(pattern.find('/', p), pattern.size());
+                size_t valueEnd = min(path.find('/', q), path.size());
+                if (valueEnd == q)
+                    return false;
+                pathParams[pattern.substr(p + 1, nameEnd - p - 1)] = path.substr(q, valueEnd - q);
+                p = nameEnd;
+                q = valueEnd;
+            }
+            else if (pattern[p++] != path[q++])
+            {
+                return false;
+            }
+        }
+        return p == pattern.size() && q == path.size();
+    }
+
+public:
+    void add(const char *method, const string &pattern, Handler handler)
+    {
+        routes.push_back({method, pattern, move(handler), nullptr});
+    }
+
+    void addStream(const string &pattern, StreamHandler handler)
+    {
+        routes.push_back({"GET", pattern, nullptr, move(handler)});
+    }
+
+    void mount(httplib::Server &svr) const
+    {
+        for (const Route &route : routes)
+        {
+            if (route.stream)
+            {
+                StreamHandler stream = route.stream;
+                svr.Get(route.pattern, [stream](const httplib::Request &req, httplib::Response &res)
+                        {
+                    EventSubscription subscription;
+                    if (stream(req, res, subscription))
+                        EventSubscription::writeOnThread(res, move(subscription)); });
+            }
+            else if (route.method == "GET")
+                svr.Get(route.pattern, route.handler);
+            else if (route.method == "POST")
+                svr.Post(route.pattern, route.handler);
+            else if (route.method == "OPTIONS")
+                svr.Options(route.pattern, route.handler);
+        }
+    }
+
+    // 按注册顺序找第一个匹配的路由并填好 path_params，没有时返回 nullptr
+    const Route *find(const string &method, const string &path, unordered_map<string, string> &pathParams) const
+    {
+        for (const Route &route : routes)
+        {
+            if (route.method == method && matchPattern(route.pattern, path, pathParams))
+                return &route;
+            pathParams.clear();
+        }
+        return nullptr;
+    }
+};
+
+// ========================================
+// EpollFrontend - 基于 epoll 的 HTTP 前端（GOBANG_FRONTEND=epoll，默认）
+// 每个 CPU 核一个事件循环，各自用 SO_REUSEPORT 监听同一端口，由内核分配连接。
+// 套接字全部非阻塞、边沿触发，请求头和正文在事件循环里增量解析，只有完整的请求才交给
+// 工作线程执行 ApiRouter 里的处理函数，响应通过 eventfd 送回事件循环写出。
+// 玩家两步之间的空闲连接只占一个 Connection 和读写缓冲，不占线程。
+// SSE 事件流也留在事件循环里：对局有新事件时 GameEventLog 唤醒循环，由循环非阻塞地写出，
+// 订阅者再多也不占工作线程
+// ========================================
+class EpollFrontend
+{
+private:
+    static constexpr size_t MAX_HEADER_BYTES = 8192;
+    static constexpr size_t MAX_BODY_BYTES = 65536;
+    static constexpr int MAX_EVENTS = 256;
+
+    enum ReadResult
+    {
+        READ_OPEN,        // 读到 EAGAIN，连接还开着
+        READ_PEER_CLOSED, // 读到 EOF：对方不再发送，但可能还在等之前请求的响应
+        READ_ERROR        // 出错或请求超长，直接关闭
+    };
+    static constexpr size_t MAX_STREAM_BACKLOG = 256 * 1024; // 事件流订阅者读得慢时，缓冲积压到这么多就先不取新事件
+
+    struct Connection
+    {
+        int fd;
+        uint64_t id;              // fd 会被复用，工作线程送回结果时用 id 确认还是同一条连接
+        string input;
+        string output;
+        size_t outputPos = 0;
+        bool busy = false;        // 有请求正在工作线程里处理，后续请求先留在 input 里
+        bool closeAfterWrite = false;
+        bool peerClosed = false;  // 对方已半关闭（shutdown 写端），已收到的请求照常应答，答完再关
+        int64_t lastActiveMs = 0;
+
+        // 非空时这条连接是 SSE 事件流，之后不再读请求
+        unique_ptr<EventSubscription> stream;
+        int watchId = 0;
+        int64_t lastStreamWriteMs = 0;
+    };
+
+    // 工作线程处理完的请求
+    struct Completion
+    {
+        int fd;
+        uint64_t connectionId;
+        string data;                              // 序列化好的响应；事件流时只有响应头
+        bool keepAlive;
+        shared_ptr<EventSubscription> stream;     // 非空时开始推送事件流
+    };
+
+    class Loop
+    {
+    private:
+        EpollFrontend &owner;
+        int listenFd;
+        int epollFd;
+        int wakeFd;
+        uint64_t nextId;
+        unordered_map<int, unique_ptr<Connection>> connections;
+
+        mutex completionsMutex;
+        vector<Completion> completions;
+        vector<pair<int, uint64_t>> streamWakeups; // 有新事件的事件流连接（fd, id）
+
+        void watch(int fd, uint32_t events)
+        {
+            epoll_event ev{};
+            ev.events = events;
+            ev.data.fd = fd;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+        }
+
+        void closeConnection(int fd)
+        {
+            auto it = connections.find(fd);
+            if (it != connections.end() && it->second->stream)
+                it->second->stream->session->events.unwatch(it->second->watchId);
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+            close(fd);
+            connections.erase(fd);
+            owner.openConnections--;
+        }
+
+        void appendChunk(Connection &conn, const string &data)
+        {
+            char size[20];
+            snprintf(size, sizeof(size), "%zx\r\n", data.size());
+            conn.output += size;
+            conn.output += data;
+            conn.output += "\r\n";
+            conn.lastStreamWriteMs = nowMs();
+        }
+
+        // 把事件流的新事件写成一个分块并尽量写出；事件流已关闭时写结束块，写完后关闭连接。
+        // 对方读得慢、缓冲积压太多时先不取，等 EPOLLOUT 写空了再取。返回 false 表示连接已关闭
+        bool pumpStream(Connection &conn)
+        {
+            if (!conn.stream || conn.output.size() - conn.outputPos > MAX_STREAM_BACKLOG)
+                return true;
+            string batch;
+            bool open = conn.stream->take(batch, chrono::milliseconds(0));
+            if (!batch.empty())
+                appendChunk(conn, batch);
+            if (!open)
+            {
+                conn.stream->session->events.unwatch(conn.watchId);
+                conn.stream.reset();
+                conn.output += "0\r\n\r\n";
+                conn.closeAfterWrite = true;
+            }
+            return flush(conn);
+        }
+
+        // 工作线程校验完订阅：写响应头，登记到对局的事件日志上，先补发已有的事件
+        void startStream(Connection &conn, Completion &done)
+        {
+            conn.stream = make_unique<EventSubscription>(move(*done.stream));
+            conn.output += done.data;
+            conn.input.clear();
+            conn.lastStreamWriteMs = nowMs();
+            int fd = conn.fd;
+            uint64_t id = conn.id;
+            conn.watchId = conn.stream->session->events.watch([this, fd, id]()
+                                                              {
+                {
+                    lock_guard<mutex> lock(completionsMutex);
+                    streamWakeups.emplace_back(fd, id);
+                }
+                wake(); });
+            pumpStream(conn);
+        }
+
+        void acceptAll()
+        {
+            while (true)
+            {
+                int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0)
+                {
+                    if (errno == EINTR || errno == ECONNABORTED)
+                        continue;
+                    return; // EAGAIN：本轮的连接都接完了
+                }
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+                auto conn = make_unique<Connection>();
+                conn->fd = fd;
+                conn->id = nextId++;
+                conn->lastActiveMs = nowMs();
+                connections[fd] = move(conn);
+                owner.openConnections++;
+                watch(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+            }
+        }
+
+        // 边沿触发：一次读到 EAGAIN 或 EOF
+        ReadResult readAll(Connection &conn)
+        {
+            char chunk[16384];
+            while (true)
+            {
+                ssize_t n = recv(conn.fd, chunk, sizeof(chunk), 0);
+                if (n > 0)
+                {
+                    conn.input.append(chunk, (size_t)n);
+                    if (conn.input.size() > MAX_HEADER_BYTES + MAX_BODY_BYTES)
+                        return READ_ERROR;
+                    continue;
+                }
+                if (n == 0)
+                    return READ_PEER_CLOSED;
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return READ_OPEN;
+                return READ_ERROR;
+            }
+        }
+
+        // 对方已半关闭时，缓冲里的请求都答完、响应写完后关闭；返回 false 表示连接已关闭
+        bool closeIfDrained(Connection &conn)
+        {
+            if (conn.peerClosed && !conn.busy && conn.output.empty())
+            {
+                closeConnection(conn.fd);
+                return false;
+            }
+            return true;
+        }
+
+        // 写出缓冲里的响应，写不完等下一次 EPOLLOUT；返回 false 表示连接已关闭
+        bool flush(Connection &conn)
+        {
+            while (conn.outputPos < conn.output.size())
+            {
+                ssize_t n = ::send(conn.fd, conn.output.data() + conn.outputPos, conn.output.size() - conn.outputPos,
+                                   MSG_NOSIGNAL);
+                if (n > 0)
+                {
+                    conn.outputPos += (size_t)n;
+                    continue;
+                }
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    return true;
+                closeConnection(conn.fd);
+                return false;
+            }
+            conn.output.clear();
+            conn.outputPos = 0;
+            if (conn.closeAfterWrite)
+            {
+                closeConnection(conn.fd);
+                return false;
+            }
+            return true;
+        }
+
+        // 在事件循环里直接回一个没有正文的错误响应并关闭连接
+        void reject(Connection &conn, int status)
+        {
+            conn.output += "HTTP/1.1 " + to_string(status) + " " + httplib::status_message(status) +
+                           "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            conn.closeAfterWrite = true;
+            conn.input.clear();
+            flush(conn);
+        }
+
+        // 从 input 里解析出一个完整的请求交给工作线程；请求还不完整时什么都不做
+        void processInput(Connection &conn)
+        {
+            if (conn.busy || !conn.output.empty())
+                return;
+            size_t headEnd = conn.input.find("\r\n\r\n");
+            if (headEnd == string::npos ? conn.input.size() > MAX_HEADER_BYTES : headEnd > MAX_HEADER_BYTES)
+            {
+                reject(conn, 431);
+                return;
+            }
+            if (headEnd == string::npos)
+                return;
+
+            auto req = make_shared<httplib::Request>();
+            if (!parseHead(string_view(conn.input.data(), headEnd), *req))
+            {
+                reject(conn, 400);
+                return;
+            }
+            if (req->has_header("Transfer-Encoding"))
+            {
+                reject(conn, 501);
+                return;
+            }
+            size_t bodyLength = (size_t)atoll(req->get_header_value("Content-Length").c_str());
+            if (bodyLength > MAX_BODY_BYTES)
+            {
+                reject(conn, 413);
+                return;
+            }
+            size_t total = headEnd + 4 + bodyLength;
+            if (conn.input.size() < total)
+                return;
+            req->body.assign(conn.input, headEnd + 4, bodyLength);
+            conn.input.erase(0, total);
+
+            string connection = req->get_header_value("Connection");
+            bool keepAlive = req->version == "HTTP/1.1" ? connection != "close" : connection == "keep-alive";
+            conn.busy = true;
+            owner.dispatch(*this, conn.fd, conn.id, req, keepAlive);
+        }
+
+        void handleEvent(int fd, uint32_t events)
+        {
+            auto it = connections.find(fd);
+            if (it == connections.end())
+                return;
+            Connection &conn = *it->second;
+            conn.lastActiveMs = nowMs();
+
+            if (events & EPOLLERR)
+            {
+                closeConnection(fd);
+                return;
+            }
+            if (events & EPOLLOUT)
+            {
+                if (!flush(conn) || !pumpStream(conn))
+                    return;
+            }
+            if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))
+            {
+                ReadResult result = readAll(conn);
+                if (result == READ_ERROR || (result == READ_PEER_CLOSED && conn.stream))
+                {
+                    closeConnection(fd);
+                    return;
+                }
+                if (result == READ_PEER_CLOSED)
+                    conn.peerClosed = true;
+            }
+            if (conn.stream)
+            {
+                conn.input.clear(); // 事件流连接上对方再发什么都不处理
+                return;
+            }
+            processInput(conn);
+            closeIfDrained(conn);
+        }
+
+        void processCompletions()
+        {
+            uint64_t counter;
+            while (read(wakeFd, &counter, sizeof(counter)) > 0)
+            {
+            }
+
+            vector<Completion> ready;
+            vector<pair<int, uint64_t>> wakeups;
+            {
+                lock_guard<mutex> lock(completionsMutex);
+                ready.swap(completions);
+                wakeups.swap(streamWakeups);
+            }
+            for (Completion &done : ready)
+            {
+                auto it = connections.find(done.fd);
+                if (it == connections.end() || it->second->id != done.connectionId)
+                    continue; // 处理期间连接已经断开
+                Connection &conn = *it->second;
+
+                if (done.stream)
+                {
+                    startStream(conn, done);
+                    continue;
+                }
+
+                conn.busy = false;
+                conn.closeAfterWrite = !done.keepAlive;
+                conn.output += done.data;
+                conn.lastActiveMs = nowMs();
+                if (flush(conn))
+                {
+                    processInput(conn); // 客户端可能已经把下一个请求发过来了
+                    closeIfDrained(conn);
+                }
             }
-            else
+            for (const auto &wakeup : wakeups)
             {
-                break;
+                auto it = connections.find(wakeup.first);
+                if (it != connections.end() && it->second->id == wakeup.second)
+                    pumpStream(*it->second);
             }
         }
-        if (count >= 5)
-            return true;
 
-        // 3. 右斜方向 (\)
-        count = 1;
-        for (int i = row - 1, j = col - 1; i >= 0 && j >= 0; i--, j--)
+        // 关闭空闲太久的连接（正在处理请求的和事件流不动），事件流太久没写时发一行注释保活
+        void sweepIdle()
         {
-            if (chessMap[i][j] == playerChess)
+            int64_t now = nowMs();
+            int64_t deadline = now - owner.keepAliveSeconds * 1000LL;
+            int64_t keepAliveBefore = now - EventSubscription::KEEP_ALIVE_SECONDS * 1000LL;
+            vector<int> idle;
+            vector<int> quietStreams;
+            for (const auto &entry : connections)
             {
-                count++;
+                const Connection &conn = *entry.second;
+                if (conn.stream && conn.lastStreamWriteMs < keepAliveBefore)
+                    quietStreams.push_back(entry.first);
+                else if (!conn.busy && conn.lastActiveMs < deadline)
+                    idle.push_back(entry.first);
             }
-            else
+            for (int fd : idle)
+                closeConnection(fd);
+            for (int fd : quietStreams)
             {
-                break;
+                Connection &conn = *connections[fd];
+                appendChunk(conn, ": keep-alive\n\n");
+                flush(conn);
             }
         }
-        for (int i = row + 1, j = col + 1; i < gradeSize && j < gradeSize; i++, j++)
+
+    public:
+        thread worker;
+
+        Loop(EpollFrontend &owner) : owner(owner), listenFd(-1), epollFd(-1), wakeFd(-1), nextId(1) {}
+
+        ~Loop()
         {
-            if (chessMap[i][j] == playerChess)
+            for (auto &entry : connections)
             {
-                count++;
-            }
-            else
-            {
-                break;
+                if (entry.second->stream)
+                    entry.second->stream->session->events.unwatch(entry.second->watchId);
+                close(entry.first);
             }
+            if (listenFd >= 0)
+                close(listenFd);
+            if (epollFd >= 0)
+                close(epollFd);
+            if (wakeFd >= 0)
+                close(wakeFd);
         }
-        if (count >= 5)
+
+        bool open(const char *host, int port)
+        {
+            listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            epollFd = epoll_create1(EPOLL_CLOEXEC);
+            wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (listenFd < 0 || epollFd < 0 || wakeFd < 0)
+                return false;
+
+            int one = 1;
+            setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            setsockopt(listenFd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons((uint16_t)port);
+            if (inet_pton(AF_INET, host, &addr.sin_addr) != 1 ||
+                ::bind(listenFd, (sockaddr *)&addr, sizeof(addr)) != 0 || ::listen(listenFd, SOMAXCONN) != 0)
+                return false;
+
+            watch(listenFd, EPOLLIN | EPOLLET);
+            watch(wakeFd, EPOLLIN | EPOLLET);
             return true;
+        }
 
-        // 4. 左斜方向 (/)
-        count = 1;
-        for (int i = row - 1, j = col + 1; i >= 0 && j < gradeSize; i--, j++)
+        void run()
         {
-            if (chessMap[i][j] == playerChess)
-            {
-                count++;
-            }
-            else
+            epoll_event events[MAX_EVENTS];
+            int64_t lastSweep = nowMs();
+            while (owner.running.load(memory_order_relaxed))
             {
-                break;
+                int n = epoll_wait(epollFd, events, MAX_EVENTS, 1000);
+                for (int i = 0; i < n; i++)
+                {
+                    int fd = events[i].data.fd;
+                    if (fd == listenFd)
+                        acceptAll();
+                    else if (fd == wakeFd)
+                        processCompletions();
+                    else
+                        handleEvent(fd, events[i].events);
+                }
+                if (nowMs() - lastSweep >= 1000)
+                {
+                    sweepIdle();
+                    lastSweep = nowMs();
+                }
             }
         }
-        for (int i = row + 1, j = col - 1; i < gradeSize && j >= 0; i++, j--)
+
+        // 工作线程调用：把结果交回事件循环
+        void post(Completion done)
         {
-            if (chessMap[i][j] == playerChess)
-            {
-                count++;
-            }
-            else
             {
-                break;
+                lock_guard<mutex> lock(completionsMutex);
+                completions.push_back(move(done));
             }
+            wake();
         }
-        if (count >= 5)
-            return true;
 
-        return false;
-    }
+        // 只调用 write()，可以在信号处理函数里使用
+        void wake()
+        {
+            uint64_t one = 1;
+            ssize_t ignored = write(wakeFd, &one, sizeof(one));
+            (void)ignored;
+        }
 
-    // 对应 Chess::getGradeSize()
-    int getGradeSize() const
+    };
+
+    const ApiRouter &router;
+    httplib::TaskQueue &workers;
+    string staticDir;
+    int keepAliveSeconds;
+    atomic<bool> running;
+    vector<unique_ptr<Loop>> loops;
+    atomic<long long> openConnections; // 各事件循环当前持有的连接数之和，供 /metrics 使用
+
+    // 解析请求行和请求头，不含结尾的空行
+    static bool parseHead(string_view head, httplib::Request &req)
     {
-        return gradeSize;
+        size_t lineEnd = head.find("\r\n");
+        string_view requestLine = head.substr(0, lineEnd);
+        size_t methodEnd = requestLine.find(' ');
+        size_t targetEnd = requestLine.rfind(' ');
+        if (methodEnd == string_view::npos || targetEnd <= methodEnd)
+            return false;
+        req.method.assign(requestLine.substr(0, methodEnd));
+        req.target.assign(requestLine.substr(methodEnd + 1, targetEnd - methodEnd - 1));
+        req.version.assign(requestLine.substr(targetEnd + 1));
+
+        size_t queryStart = req.target.find('?');
+        req.path = httplib::decode_path_component(req.target.substr(0, queryStart));
+        if (queryStart != string::npos)
+            httplib::detail::parse_query_text(req.target.substr(queryStart + 1), req.params);
+
+        while (lineEnd != string_view::npos)
+        {
+            size_t start = lineEnd + 2;
+            lineEnd = head.find("\r\n", start);
+            string_view line = head.substr(start, lineEnd == string_view::npos ? string_view::npos : lineEnd - start);
+            size_t colon = line.find(':');
+            if (colon == string_view::npos || colon == 0)
+                return false;
+            size_t valueStart = colon + 1;
+            while (valueStart < line.size() && (line[valueStart] == ' ' || line[valueStart] == '\t'))
+                valueStart++;
+            size_t valueEnd = line.size();
+            while (valueEnd > valueStart && (line[valueEnd - 1] == ' ' || line[valueEnd - 1] == '\t'))
+                valueEnd--;
+            req.headers.emplace(string(line.substr(0, colon)), string(line.substr(valueStart, valueEnd - valueStart)));
+        }
+        return true;
     }
 
-    // 对应 Chess::getChessData()
-    int getChessData(int row, int col) const
+    static string serialize(const httplib::Response &res, bool keepAlive)
     {
-        if (row < 0 || row >= gradeSize || col < 0 || col >= gradeSize)
+        int status = res.status == -1 ? 200 : res.status;
+        string out = "HTTP/1.1 " + to_string(status) + " " + httplib::status_message(status) + "\r\n";
+        for (const auto &header : res.headers)
         {
-            return 0;
+            out += header.first + ": " + header.second + "\r\n";
         }
-        return chessMap[row][col];
+        bool hasBody = status != 204 && status != 304;
+        if (hasBody)
+            out += "Content-Length: " + to_string(res.body.size()) + "\r\n";
+        out += keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+        if (hasBody)
+            out += res.body;
+        return out;
     }
 
-    // 获取棋盘状态（用于返回给前端）
-    vector<vector<int>> getBoard() const
+    // 事件流的响应头，之后的正文由事件循环按分块编码写出，结束后关闭连接
+    static string streamHead(httplib::Response &res)
     {
-        return chessMap;
+        res.set_header("Content-Type", "text/event-stream");
+        int status = res.status == -1 ? 200 : res.status;
+        string out = "HTTP/1.1 " + to_string(status) + " " + httplib::status_message(status) + "\r\n";
+        for (const auto &header : res.headers)
+        {
+            out += header.first + ": " + header.second + "\r\n";
+        }
+        out += "Transfer-Encoding: chunked\r\nConnection: close\r\n\r\n";
+        return out;
     }
 
-    ChessPos getLastPos() const
+    // 没有匹配的接口时按静态文件处理（与 httplib 的 set_base_dir 相同的目录）
+    bool serveStatic(const httplib::Request &req, httplib::Response &res) const
     {
-        return lastPos;
+        if (staticDir.empty() || req.method != "GET" || req.path.find("..") != string::npos)
+            return false;
+        string path = staticDir + (req.path == "/" ? "/index.html" : req.path);
+        ifstream file(path, ios::binary);
+        if (!file)
+            return false;
+        string content((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+        static const pair<const char *, const char *> types[] = {
+            {".html", "text/html"}, {".js", "text/javascript"}, {".css", "text/css"},
+            {".png", "image/png"}, {".jpg", "image/jpeg"}, {".svg", "image/svg+xml"},
+            {".ico", "image/x-icon"}, {".json", "application/json"}};
+        const char *type = "application/octet-stream";
+        for (const auto &entry : types)
+        {
+            size_t extLength = strlen(entry.first);
+            if (path.size() >= extLength && path.compare(path.size() - extLength, extLength, entry.first) == 0)
+                type = entry.second;
+        }
+        res.set_content(move(content), type);
+        return true;
     }
-};
 
-// ========================================
-// AILogic 类 - 从你的 AI.cpp 改编
-// ========================================
-class AILogic
-{
-private:
-    ChessLogic *chess;
-    vector<vector<int>> scoreMap;
+    // 在工作线程里执行处理函数，结果送回事件循环
+    void dispatch(Loop &loop, int fd, uint64_t connectionId, shared_ptr<httplib::Request> req, bool keepAlive)
+    {
+        auto start = chrono::steady_clock::now();
+        bool queued = workers.enqueue([this, &loop, fd, connectionId, req, keepAlive, start]()
+                                      {
+            auto res = make_shared<httplib::Response>();
+            shared_ptr<EventSubscription> subscription;
+            const ApiRouter::Route *route = router.find(req->method, req->path, req->path_params);
+            try {
+                if (route != nullptr && route->stream) {
+                    subscription = make_shared<EventSubscription>();
+                    if (!route->stream(*req, *res, *subscription))
+                        subscription.reset();
+                } else if (route != nullptr) {
+                    route->handler(*req, *res);
+                } else if (!serveStatic(*req, *res)) {
+                    res->status = 404;
+                }
+            } catch (const exception &e) {
+                res->status = 500;
+                res->set_content(JsonWriter::error("Internal error", e.what()), "application/json");
+            }
 
-public:
-    AILogic() : chess(nullptr) {}
+            ServerMetrics &metrics = ServerMetrics::instance();
+            ServerMetrics::Route metricRoute = ServerMetrics::routeOf(req->path);
+            metrics.requests[metricRoute].add();
+            metrics.latency[metricRoute].record(chrono::steady_clock::now() - start);
 
-    // 对应 AI::init()
-    void init(ChessLogic *chess)
-    {
-        this->chess = chess;
-        int size = chess->getGradeSize();
+            Completion done{fd, connectionId, string(), keepAlive, subscription};
+            done.data = subscription ? streamHead(*res) : serialize(*res, keepAlive);
+            loop.post(move(done)); });
 
-        scoreMap.clear();
-        for (int i = 0; i < size; i++)
+        if (!queued)
         {
-            vector<int> row;
-            for (int j = 0; j < size; j++)
-            {
-                row.push_back(0);
-            }
-            scoreMap.push_back(row);
+            Completion done{fd, connectionId, string(), false, nullptr};
+            httplib::Response res;
+            res.status = 503;
+            done.data = serialize(res, false);
+            loop.post(move(done));
         }
     }
 
-    // 对应 AI::go()
-    ChessPos go()
+public:
+    EpollFrontend(const ApiRouter &router, httplib::TaskQueue &workers, const string &staticDir, int keepAliveSeconds)
+        : router(router), workers(workers), staticDir(staticDir), keepAliveSeconds(keepAliveSeconds),
+          running(false), openConnections(0)
     {
-        return think();
     }
 
-    // 对应 AI::think()
-    ChessPos think()
+    // 为每个事件循环打开一个 SO_REUSEPORT 监听套接字
+    bool listen(const char *host, int port, int loopCount)
     {
-        calculateScore();
-
-        vector<ChessPos> maxPoints;
-        int maxScore = 0;
-        int size = chess->getGradeSize();
-
-        for (int row = 0; row < size; row++)
+        for (int i = 0; i < max(1, loopCount); i++)
         {
-            for (int col = 0; col < size; col++)
-            {
-                if (chess->getChessData(row, col) != 0)
-                    continue;
-
-                if (scoreMap[row][col] > maxScore)
-                {
-                    maxScore = scoreMap[row][col];
-                    maxPoints.clear();
-                    maxPoints.push_back(ChessPos(row, col));
-                }
-                else if (scoreMap[row][col] == maxScore)
-                {
-                    maxPoints.push_back(ChessPos(row, col));
-                }
-            }
+            auto loop = make_unique<Loop>(*this);
+            if (!loop->open(host, port))
+                return false;
+            loops.push_back(move(loop));
         }
+        return true;
+    }
 
-        if (maxPoints.empty())
+    // 运行所有事件循环，直到 stop()
+    void run()
+    {
+        running = true;
+        for (auto &loop : loops)
         {
-            return ChessPos(-1, -1);
+            Loop *self = loop.get();
+            loop->worker = thread([self]() { self->run(); });
+        }
+        for (auto &loop : loops)
+        {
+            loop->worker.join();
         }
-
-        int ind = rand() % maxPoints.size();
-        return maxPoints[ind];
     }
 
-    // 对应 AI::calculateScore() - 100%保留你的算法
-    void calculateScore()
+    // 只设置标志并写 eventfd，可以在信号处理函数里调用
+    void stop()
     {
-        int personNum = 0;
-        int aiNum = 0;
-        int emptyNum = 0;
-
-        int size = chess->getGradeSize();
-
-        // 清空分数
-        for (int i = 0; i < size; i++)
+        running.store(false);
+        for (auto &loop : loops)
         {
-            for (int j = 0; j < size; j++)
-            {
-                scoreMap[i][j] = 0;
-            }
+            loop->wake();
         }
+    }
 
-        for (int row = 0; row < size; row++)
-        {
-            for (int col = 0; col < size; col++)
-            {
-                if (chess->getChessData(row, col))
-                    continue;
-
-                for (int y = -1; y <= 0; y++)
-                {
-                    for (int x = -1; x <= 1; x++)
-                    {
-                        if (x == 0 && y == 0)
-                            continue;
-                        if (x != 1 && y == 0)
-                            continue;
-
-                        personNum = 0;
-                        aiNum = 0;
-                        emptyNum = 0;
-
-                        // 正向检查玩家（黑棋）
-                        for (int i = 1; i <= 4; i++)
-                        {
-                            int curRow = row + i * y;
-                            int curCol = col + i * x;
-
-                            if (curRow >= 0 && curRow < size &&
-                                curCol >= 0 && curCol < size &&
-                                chess->getChessData(curRow, curCol) == 1)
-                            {
-                                personNum++;
-                            }
-                            else if (curRow >= 0 && curRow < size &&
-                                     curCol >= 0 && curCol < size &&
-                                     chess->getChessData(curRow, curCol) == 0)
-                            {
-                                emptyNum++;
-                                break;
-                            }
-                            else
-                            {
-                                break;
-                            }
-                        }
-
-                        // 反向检查
-                        for (int i = 1; i <= 4; i++)
-                        {
-                            int curRow = row - i * y;
-                            int curCol = col - i * x;
-
-                            if (curRow >= 0 && curRow < size &&
-                                curCol >= 0 && curCol < size &&
-                                chess->getChessData(curRow, curCol) == 1)
-                            {
-                                personNum++;
-                            }
-                            else if (curRow >= 0 && curRow < size &&
-                                     curCol >= 0 && curCol < size &&
-                                     chess->getChessData(curRow, curCol) == 0)
-                            {
-                                emptyNum++;
-                                break;
-                            }
-                            else
-                            {
-                                break;
-                            }
-                        }
-
-                        // 玩家威胁评分
-                        if (personNum == 1)
-                        {
-                            scoreMap[row][col] += 10;
-                        }
-                        else if (personNum == 2)
-                        {
-                            if (emptyNum == 1)
-                            {
-                                scoreMap[row][col] += 30;
-                            }
-                            else if (emptyNum == 2)
-                            {
-                                scoreMap[row][col] += 40;
-                            }
-                        }
-                        else if (personNum == 3)
-                        {
-                            if (emptyNum == 1)
-                            {
-                                scoreMap[row][col] += 60;
-                            }
-                            else if (emptyNum == 2)
-                            {
-                                scoreMap[row][col] += 200;
-                            }
-                        }
-                        else if (personNum == 4)
-                        {
-                            scoreMap[row][col] += 20000;
-                        }
-
-                        // 检查AI（白棋）
-                        emptyNum = 0;
+    int loopCount() const
+    {
+        return (int)loops.size();
+    }
 
-                        for (int i = 1; i <= 4; i++)
-                        {
-                            int curRow = row + i * y;
-                            int curCol = col + i * x;
-
-                            if (curRow >= 0 && curRow < size &&
-                                curCol >= 0 && curCol < size &&
-                                chess->getChessData(curRow, curCol) == -1)
-                            {
-                                aiNum++;
-                            }
-                            else if (curRow >= 0 && curRow < size &&
-                                     curCol >= 0 && curCol < size &&
-                                     chess->getChessData(curRow, curCol) == 0)
-                            {
-                                emptyNum++;
-                                break;
-                            }
-                            else
-                            {
-                                break;
-                            }
-                        }
-
-                        for (int i = 1; i <= 4; i++)
-                        {
-                            int curRow = row - i * y;
-                            int curCol = col - i * x;
-
-                            if (curRow >= 0 && curRow < size &&
-                                curCol >= 0 && curCol < size &&
-                                chess->getChessData(curRow, curCol) == -1)
-                            {
-                                aiNum++;
-                            }
-                            else if (curRow >= 0 && curRow < size &&
-                                     curCol >= 0 && curCol < size &&
-                                     chess->getChessData(curRow, curCol) == 0)
-                            {
-                                emptyNum++;
-                                break;
-                            }
-                            else
-                            {
-                                break;
-                            }
-                        }
-
-                        // AI进攻评分
-                        if (aiNum == 0)
-                        {
-                            scoreMap[row][col] += 5;
-                        }
-                        else if (aiNum == 1)
-                        {
-                            scoreMap[row][col] += 10;
-                        }
-                        else if (aiNum == 2)
-                        {
-                            if (emptyNum == 1)
-                            {
-                                scoreMap[row][col] += 25;
-                            }
-                            else if (emptyNum == 2)
-                            {
-                                scoreMap[row][col] += 50;
-                            }
-                        }
-                        else if (aiNum == 3)
-                        {
-                            if (emptyNum == 1)
-                            {
-                                scoreMap[row][col] += 55;
-                            }
-                            else if (emptyNum == 2)
-                            {
-                                scoreMap[row][col] += 10000;
-                            }
-                        }
-                        else if (aiNum == 4)
-                        {
-                            scoreMap[row][col] += 30000;
-                        }
-                    }
-                }
-            }
-        }
+    long long connectionCount() const
+    {
+        return openConnections.load(memory_order_relaxed);
     }
 };
 
 // ========================================
 // HTTP 服务器主程序
+// bench.cpp 定义 GOBANG_NO_MAIN 后直接包含本文件，只使用上面的引擎部分
 // ========================================
-int main()
+#ifndef GOBANG_NO_MAIN
+
+// Ctrl+C / kill 时让 listen() / run() 返回，正常析构，日志线程写完缓冲区里剩余的日志
+static httplib::Server *runningServer = nullptr;
+static EpollFrontend *runningFrontend = nullptr;
+
+static void handleStopSignal(int)
 {
-    srand(time(nullptr));
+    if (runningServer != nullptr)
+    {
+        runningServer->stop();
+    }
+    if (runningFrontend != nullptr)
+    {
+        runningFrontend->stop();
+    }
+}
 
+int main()
+{
     httplib::Server svr;
+    runningServer = &svr;
+    signal(SIGINT, handleStopSignal);
+    signal(SIGTERM, handleStopSignal);
+
+    ServerConfig config = ServerConfig::fromEnv();
+
+    // 用可统计排队深度的线程池替换 httplib 默认的线程池；httplib 的 SSE 事件流另有自己的线程，不占处理请求的线程
+    // epoll 前端的事件流由事件循环写出，不占线程，可以开得多
+    ServerLoad load;
+    load.workerCount = CPPHTTPLIB_THREAD_POOL_COUNT;
+    int maxStreams = config.sseMaxStreams > 0 ? config.sseMaxStreams : config.frontend == "epoll" ? 4096 : 64;
+    svr.new_task_queue = [&load, maxStreams]
+    { return new MonitoredThreadPool(load, maxStreams); };
+
+    // 请求日志由后台线程批量写出，不再在请求线程里 endl 刷新
+    Logger::instance().start(config.logFile, (long long)config.logMaxMegabytes * 1024 * 1024, config.logKeepFiles);
+
+    // 按 CPU 选择评分内核，GOBANG_SCORE_KERNEL=scalar/sse2 可强制指定
+    ScoreKernel::Kind kernel = ScoreKernel::select(getenv("GOBANG_SCORE_KERNEL"));
+    cout << "评分内核: " << ScoreKernel::name(kernel) << endl;
+
+    // 所有对局共享的置换表
+    TranspositionTable &tt = TranspositionTable::shared();
+    tt.resize(config.ttMegabytes);
+    tt.setPolicy(config.ttPolicy == "always" ? TT_REPLACE_ALWAYS : TT_REPLACE_DEPTH);
+    cout << "置换表: " << tt.sizeBytes() / (1024 * 1024) << " MB, 策略=" << config.ttPolicy << endl;
 
     // 存储游戏会话
-    map<string, shared_ptr<ChessLogic>> games;
-    map<string, shared_ptr<AILogic>> aiInstances;
-    int gameIdCounter = 0;
+    SessionStore sessions(config);
+    sessions.startReaper();
+
+    // AI 搜索线程池，落子请求只负责玩家这一步
+    int aiThreads = config.aiThreads > 0 ? config.aiThreads : max(1, (int)thread::hardware_concurrency());
+    AiWorkerPool aiPool(aiThreads, config.aiQueue);
+    aiPool.start();
+    MoveService moveService(sessions, aiPool);
+    cout << "AI 线程: " << aiThreads << ", 队列上限 " << config.aiQueue << ", 落子最多等待 " << config.aiWaitMs << "ms" << endl;
+
+    // WebSocket 对局通道，单独监听一个端口
+    WebSocketServer webSocket(sessions, moveService, config.wsMaxConnections, config.idleTtlSeconds);
+    if (config.wsPort > 0)
+    {
+        if (webSocket.start("0.0.0.0", config.wsPort))
+        {
+            cout << "WebSocket: ws://0.0.0.0:" << config.wsPort << "/ws/game, 最多 "
+                 << webSocket.connectionLimit() << " 条连接" << endl;
+        }
+        else
+        {
+            cerr << "警告：WebSocket 端口 " << config.wsPort << " 无法监听，只提供 HTTP 接口" << endl;
+        }
+    }
+
+    // 请求计时：路由前记下开始时间，响应写完后（set_logger 回调，同一线程）按接口记入直方图
+    static thread_local chrono::steady_clock::time_point requestStart;
+    svr.set_pre_routing_handler([](const httplib::Request &, httplib::Response &)
+                                {
+        requestStart = chrono::steady_clock::now();
+        return httplib::Server::HandlerResponse::Unhandled; });
+    svr.set_logger([](const httplib::Request &req, const httplib::Response &)
+                   {
+        ServerMetrics &metrics = ServerMetrics::instance();
+        ServerMetrics::Route route = ServerMetrics::routeOf(req.path);
+        metrics.requests[route].add();
+        metrics.latency[route].record(chrono::steady_clock::now() - requestStart); });
 
     cout << "========================================" << endl;
     cout << "   五子棋在线服务器" << endl;
     cout << "   基于你的 C++ 核心逻辑" << endl;
     cout << "========================================" << endl;
 
+    // 响应头和正文分两次写出，开着 Nagle 时会和客户端的延迟 ACK 叠加出约 40ms 的固定延迟
+    svr.set_tcp_nodelay(true);
+
     // CORS 中间件（允许跨域）
-    svr.set_base_dir("/home/haoW/GobangServer/");
+    const string staticDir = "/home/haoW/GobangServer/";
+    svr.set_base_dir(staticDir);
 
-    // API: 创建新游戏
-    svr.Post("/api/new-game", [&](const httplib::Request &req, httplib::Response &res)
-             {
-        auto chess = make_shared<ChessLogic>(13, 44, 43, 67.3f);
-        auto ai = make_shared<AILogic>();
-        
-        chess->init();
-        ai->init(chess.get());
-        
-        string gameId = "game_" + to_string(++gameIdCounter);
-        games[gameId] = chess;
-        aiInstances[gameId] = ai;
+    // 接口先登记到路由表，再按 GOBANG_FRONTEND 挂到 httplib 或 epoll 前端上
+    ApiRouter api;
+    unique_ptr<MonitoredThreadPool> httpWorkers;
+    unique_ptr<EpollFrontend> frontend;
+    if (config.frontend == "epoll")
+    {
+        httpWorkers = make_unique<MonitoredThreadPool>(load);
+        frontend = make_unique<EpollFrontend>(api, *httpWorkers, staticDir, config.keepAliveSeconds);
+    }
 
-        json response;
-        response["gameId"] = gameId;
-        response["gradeSize"] = 13;
-        
+    // API: 创建新游戏
+    api.add("POST", "/api/new-game", [&](const httplib::Request &req, httplib::Response &res)
+                    {
         res.set_header("Access-Control-Allow-Origin", "*");
         res.set_header("Access-Control-Allow-Methods", "POST, GET, OPTIONS");
         res.set_header("Access-Control-Allow-Headers", "Content-Type");
-        res.set_content(response.dump(), "application/json");
+
+        // 参数见 NewGameRequest::read；seed 不传则由服务器生成
+        NewGameRequest request;
+        request.seed = sessions.nextSeed();
+        try {
+            if (!req.body.empty()) {
+                if (const char *error = request.read(json::parse(req.body))) {
+                    res.set_content(JsonWriter::error(error), "application/json");
+                    return;
+                }
+            }
+        } catch (const exception& e) {
+            res.set_content(JsonWriter::error("Invalid request", e.what()), "application/json");
+            return;
+        }
+
+        auto session = request.start(sessions);
+
+        JsonWriter response;
+        response.beginObject();
+        request.writeFields(response, session->gameId);
+        response.endObject();
         
-        cout << "[新游戏] gameId=" << gameId << endl; });
+        res.set_content(response.str(), "application/json"); });
+
+    // AI 还没算完时的响应：玩家这一步已落下，凭 ticket 到 /api/move-result 取 AI 应手
+    auto pendingResponse = [](const AiTicket &ticket) -> string {
+        JsonWriter response;
+        response.beginObject().field("success", true).field("pending", true).field("ticket", ticket.number).endObject();
+        return response.str();
+    };
 
     // API: 玩家落子
-    svr.Post("/api/move", [&](const httplib::Request &req, httplib::Response &res)
-             {
+    api.add("POST", "/api/move", [&](const httplib::Request &req, httplib::Response &res)
+                    {
         res.set_header("Access-Control-Allow-Origin", "*");
         res.set_header("Access-Control-Allow-Methods", "POST, GET, OPTIONS");
         res.set_header("Access-Control-Allow-Headers", "Content-Type");
         
         try {
-            auto body = json::parse(req.body);
-            string gameId = body["gameId"];
-            int row = body["row"];
-            int col = body["col"];
-
-            cout << "[玩家落子] gameId=" << gameId << ", pos=(" << row << "," << col << ")" << endl;
-
-            if (games.find(gameId) == games.end()) {
-                json error;
-                error["error"] = "Game not found";
-                res.set_content(error.dump(), "application/json");
+            // 常见形状走快速解析；非法 JSON 直接报错，少见写法再交给 nlohmann
+            MoveRequest move;
+            MoveParseStatus status = move.parse(req.body);
+            if (status == MOVE_PARSE_MALFORMED) {
+                string message = "malformed JSON at offset " + to_string(move.errorOffset);
+                res.set_content(JsonWriter::error("Invalid request", message.c_str()), "application/json");
                 return;
             }
-
-            auto chess = games[gameId];
-            auto ai = aiInstances[gameId];
-            
-            // 玩家落子（黑棋）
-            if (!chess->chessDown(row, col, CHESS_BLACK)) {
-                json error;
-                error["error"] = "Invalid move";
-                res.set_content(error.dump(), "application/json");
-                return;
+            string gameId;
+            string moveId;
+            int row;
+            int col;
+            if (status == MOVE_PARSE_OK) {
+                gameId.assign(move.gameId);
+                moveId.assign(move.moveId);
+                row = move.row;
+                col = move.col;
+            } else {
+                auto body = json::parse(req.body);
+                gameId = body["gameId"];
+                row = body["row"];
+                col = body["col"];
+                moveId = body.value("moveId", "");
             }
 
-            json response;
-            response["success"] = true;
-            
-            // 检查玩家是否胜利
-            if (chess->checkWin()) {
-                response["gameOver"] = true;
-                response["winner"] = "black";
-                cout << "[游戏结束] 黑棋获胜" << endl;
-                res.set_content(response.dump(), "application/json");
+            LOG_INFO("玩家落子").kv("gameId", gameId).kv("pos", ChessPos(row, col));
+
+            auto session = sessions.find(gameId);
+            if (!session) {
+                res.set_content(JsonWriter::error("Game not found"), "application/json");
                 return;
             }
 
-            // AI落子（白棋）
-            ChessPos aiPos = ai->go();
-            if (aiPos.row >= 0 && aiPos.col >= 0) {
-                chess->chessDown(aiPos.row, aiPos.col, CHESS_WHITE);
-                response["aiMove"] = {{"row", aiPos.row}, {"col", aiPos.col}};
-                
-                cout << "[AI落子] pos=(" << aiPos.row << "," << aiPos.col << ")" << endl;
-
-                // 检查AI是否胜利
-                if (chess->checkWin()) {
-                    response["gameOver"] = true;
-                    response["winner"] = "white";
-                    cout << "[游戏结束] 白棋（AI）获胜" << endl;
+            // 玩家这一步在本线程落下，AI 应手交给 AI 线程池；最多等 aiWaitMs，没算完就返回 ticket
+            MoveOutcome outcome;
+            shared_ptr<AiTicket> ticket;
+            switch (moveService.submit(session, row, col, moveId, outcome, ticket)) {
+            case MoveService::MOVE_INVALID:
+                res.set_content(JsonWriter::error("Invalid move"), "application/json");
+                return;
+            case MoveService::MOVE_OVER:
+                res.set_content(JsonWriter::error("Game over"), "application/json");
+                return;
+            case MoveService::MOVE_BUSY:
+                res.status = 503;
+                res.set_content(JsonWriter::error("Server busy"), "application/json");
+                return;
+            case MoveService::MOVE_THINKING:
+                res.set_content(JsonWriter::error("AI is thinking"), "application/json");
+                return;
+            case MoveService::MOVE_DONE:
+                break;
+            case MoveService::MOVE_QUEUED:
+                if (!ticket->wait(chrono::milliseconds(config.aiWaitMs), outcome)) {
+                    res.set_content(pendingResponse(*ticket), "application/json");
+                    return;
                 }
+                break;
             }
 
-            res.set_content(response.dump(), "application/json");
+            JsonWriter response;
+            response.beginObject();
+            outcome.writeFields(response);
+            response.endObject();
+            res.set_content(response.str(), "application/json");
         } catch (const exception& e) {
-            json error;
-            error["error"] = "Invalid request";
-            error["message"] = e.what();
-            res.set_content(error.dump(), "application/json");
+            res.set_content(JsonWriter::error("Invalid request", e.what()), "application/json");
         } });
 
+    // API: 取回排队中的 AI 应手（/api/move 返回 pending 之后调用）
+    // 最多等 aiWaitMs；还没算完时仍返回 pending，客户端再来取。也可以订阅 /api/events 等推送
+    api.add("GET", "/api/move-result/:gameId", [&](const httplib::Request &req, httplib::Response &res)
+                   {
+        res.set_header("Access-Control-Allow-Origin", "*");
+
+        auto session = sessions.find(req.path_params.at("gameId"));
+        if (!session) {
+            res.set_content(JsonWriter::error("Game not found"), "application/json");
+            return;
+        }
+        auto ticket = MoveService::findTicket(*session, atoi(req.get_param_value("ticket").c_str()));
+        if (!ticket) {
+            res.set_content(JsonWriter::error("Unknown ticket"), "application/json");
+            return;
+        }
+
+        MoveOutcome outcome;
+        if (!ticket->wait(chrono::milliseconds(config.aiWaitMs), outcome)) {
+            res.set_content(pendingResponse(*ticket), "application/json");
+            return;
+        }
+        JsonWriter response;
+        response.beginObject();
+        outcome.writeFields(response);
+        response.endObject();
+        res.set_content(response.str(), "application/json"); });
+
     // API: 获取棋盘状态
-    svr.Get("/api/board/:gameId", [&](const httplib::Request &req, httplib::Response &res)
-            {
+    api.add("GET", "/api/board/:gameId", [&](const httplib::Request &req, httplib::Response &res)
+                   {
         res.set_header("Access-Control-Allow-Origin", "*");
         
         string gameId = req.path_params.at("gameId");
-        if (games.find(gameId) == games.end()) {
-            json error;
-            error["error"] = "Game not found";
-            res.set_content(error.dump(), "application/json");
+        auto session = sessions.find(gameId);
+        if (!session) {
+            res.set_content(JsonWriter::error("Game not found"), "application/json");
             return;
         }
 
-        json response;
-        response["board"] = games[gameId]->getBoard();
-        res.set_content(response.dump(), "application/json"); });
+        // 可选参数：
+        //   since=<moveCount>  与当前步数相同时返回 304，客户端据此跳过没有变化的轮询
+        //   format=packed      board 为 base64 字符串，每格 2 位（0 空、1 黑、2 白），行优先
+        //   format=binary 或 Accept: application/octet-stream
+        //                      直接返回打包后的字节（13 路 43 字节），边长、步数和最后一手放在响应头里
+        string format = req.get_param_value("format");
+        bool binary = format == "binary" ||
+                      (format.empty() && req.get_header_value("Accept").find("application/octet-stream") != string::npos);
+        int since = req.has_param("since") ? atoi(req.get_param_value("since").c_str()) : -1;
+
+        // 读快照而不是 chess，AI 搜索期间也不用等
+        lock_guard<mutex> lock(session->snapshotMutex);
+        session->visit([&](auto &game) {
+            const auto &chess = game.snapshot;
+            int moveCount = chess.getMoveCount();
+            ChessPos last = chess.getLastPos();
+            if (moveCount == since) {
+                res.status = 304;
+                return;
+            }
+
+            uint8_t packed[(MAX_GRADE_SIZE * MAX_GRADE_SIZE + 3) / 4];
+            if (binary || format == "packed") {
+                chess.packBoard(packed);
+            }
+
+            if (binary) {
+                res.set_header("Access-Control-Expose-Headers", "X-Grade-Size, X-Move-Count, X-Last-Move");
+                res.set_header("X-Grade-Size", to_string(chess.getGradeSize()));
+                res.set_header("X-Move-Count", to_string(moveCount));
+                res.set_header("X-Last-Move", last.row >= 0 ? to_string(last.row) + "," + to_string(last.col) : "");
+                res.set_content((const char *)packed, chess.packedBytes, "application/octet-stream");
+                return;
+            }
+
+            JsonWriter response;
+            response.beginObject()
+                .field("gradeSize", chess.getGradeSize())
+                .field("moveCount", moveCount)
+                .key("lastMove");
+            if (last.row >= 0) {
+                response.beginObject().field("row", last.row).field("col", last.col).endObject();
+            } else {
+                response.null();
+            }
+
+            response.key("board");
+            if (format == "packed") {
+                response.base64(packed, chess.packedBytes);
+            } else {
+                // 直接按格输出，不再经过 getBoard() 的二维 vector
+                response.beginArray();
+                for (int i = 0; i < chess.getGradeSize(); i++) {
+                    response.beginArray();
+                    for (int j = 0; j < chess.getGradeSize(); j++) {
+                        response.value(chess.getChessData(i, j));
+                    }
+                    response.endArray();
+                }
+                response.endArray();
+            }
+            response.endObject();
+            res.set_content(response.str(), "application/json");
+        }); });
+
+    // API: 对局事件流（Server-Sent Events）
+    // 订阅后先补发已有的落子，之后每步推送一条 move 事件，分出胜负时推送 gameOver 并结束。
+    // 事件在落子时就格式化好，所有订阅者共用；断线重连时浏览器自动带 Last-Event-ID，也可以用 ?since=<id>
+    atomic<int> openStreams{0};
+    api.addStream("/api/events/:gameId", [&](const httplib::Request &req, httplib::Response &res,
+                                             EventSubscription &subscription)
+                  {
+        res.set_header("Access-Control-Allow-Origin", "*");
+
+        auto session = sessions.find(req.path_params.at("gameId"));
+        if (!session) {
+            res.set_content(JsonWriter::error("Game not found"), "application/json");
+            return false;
+        }
+        string lastId = req.get_header_value("Last-Event-ID");
+        if (lastId.empty()) {
+            lastId = req.get_param_value("since");
+        }
+
+        if (openStreams.fetch_add(1) >= maxStreams) {
+            openStreams--;
+            res.status = 503;
+            res.set_content(JsonWriter::error("Too many event streams"), "application/json");
+            return false;
+        }
+        subscription.session = session;
+        subscription.cursor = (size_t)max(0, atoi(lastId.c_str()));
+        subscription.slot = shared_ptr<void>(nullptr, [&openStreams](void *) { openStreams--; });
+
+        res.set_header("Cache-Control", "no-cache");
+        return true; });
+
+    // 指标：Prometheus 文本格式
+    api.add("GET", "/metrics", [&](const httplib::Request &, httplib::Response &res)
+                   {
+        string out;
+        ServerMetrics::instance().render(out);
+        renderMetricValue(out, "gobang_live_sessions", "gauge", "Game sessions currently held in memory.",
+                          (long long)sessions.size());
+        renderMetricValue(out, "gobang_session_evictions_total", "counter",
+                          "Sessions evicted because the session store was full.", sessions.evictions());
+        renderMetricValue(out, "gobang_session_reaped_total", "counter",
+                          "Sessions removed by the reaper after their idle or finished TTL.", sessions.reaped());
+        renderMetricValue(out, "gobang_thread_pool_queue_depth", "gauge",
+                          "Requests waiting for a worker thread.", load.queuedRequests.load(memory_order_relaxed));
+        renderMetricValue(out, "gobang_thread_pool_workers", "gauge", "Worker threads in the HTTP pool.",
+                          load.workerCount);
+        renderMetricValue(out, "gobang_http_connections", "gauge", "Connections held by the epoll event loops.",
+                          frontend ? frontend->connectionCount() : 0);
+        renderMetricValue(out, "gobang_websocket_connections", "gauge", "Open /ws/game connections.",
+                          webSocket.connectionCount());
+        renderMetricValue(out, "gobang_websocket_rejected_total", "counter",
+                          "WebSocket handshakes rejected because the connection limit was reached.",
+                          webSocket.rejected());
+        renderMetricValue(out, "gobang_sse_streams", "gauge", "Open /api/events streams.",
+                          openStreams.load(memory_order_relaxed));
+        renderMetricValue(out, "gobang_ai_queue_depth", "gauge", "AI moves waiting for a search thread.",
+                          aiPool.load().queuedRequests.load(memory_order_relaxed));
+        renderMetricValue(out, "gobang_ai_workers", "gauge", "Threads in the AI search pool.",
+                          aiPool.load().workerCount);
+        renderMetricValue(out, "gobang_ai_rejected_total", "counter",
+                          "Moves rejected because the AI queue was full.", aiPool.rejected());
+        res.set_content(out, "text/plain; version=0.0.4"); });
 
     // 处理OPTIONS请求（CORS预检）
-    svr.Options(R"(/api/.*)", [](const httplib::Request &, httplib::Response &res)
-                {
-                    res.set_header("Access-Control-Allow-Origin", "*");
-                    res.set_header("Access-Control-Allow-Methods", "POST, GET, OPTIONS");
-                    res.set_header("Access-Control-Allow-Headers", "Content-Type");
-                    res.status = 204; });
+    api.add("OPTIONS", R"(/api/.*)", [](const httplib::Request &, httplib::Response &res)
+                       {
+                           res.set_header("Access-Control-Allow-Origin", "*");
+                           res.set_header("Access-Control-Allow-Methods", "POST, GET, OPTIONS");
+                           res.set_header("Access-Control-Allow-Headers", "Content-Type");
+                           res.status = 204; });
 
     // 启动服务器
     cout << "\n服务器启动中..." << endl;
@@ -688,11 +6359,41 @@ int main()
     cout << "按 Ctrl+C 停止服务器\n"
          << endl;
 
-    if (!svr.listen("0.0.0.0", 8888))
+    bool listened;
+    if (frontend)
+    {
+        int eventLoops = config.eventLoops > 0 ? config.eventLoops : max(1, (int)thread::hardware_concurrency());
+        listened = frontend->listen("0.0.0.0", 8888, eventLoops);
+        if (listened)
+        {
+            cout << "HTTP 前端: epoll, " << frontend->loopCount() << " 个事件循环, "
+                 << load.workerCount << " 个工作线程" << endl;
+            runningFrontend = frontend.get();
+            frontend->run();
+            runningFrontend = nullptr;
+        }
+        httpWorkers->shutdown();
+    }
+    else
+    {
+        api.mount(svr);
+        listened = svr.listen("0.0.0.0", 8888);
+    }
+
+    if (!listened)
     {
         cerr << "错误：无法启动服务器，端口8888可能被占用" << endl;
+        webSocket.stop();
+        aiPool.stop();
+        Logger::instance().stop();
         return 1;
     }
 
+    LOG_INFO("服务器已停止");
+    webSocket.stop();
+    aiPool.stop();
+    sessions.stopReaper();
+    Logger::instance().stop();
     return 0;
 }
+#endif // GOBANG_NO_MAIN
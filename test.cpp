@@ -1,15 +1,765 @@
-/*************************************************************************
-	> File Name: test.cpp
-	> Author: 
-	> Mail: 
-	> Created Time: Tue 08 Apr 2025 07:45:01 PM CST
- ************************************************************************/
-
-#include<iostream>
-using namespace std;
-int main() {
-    int a = 10;
-    cout << a << endl;
-
-    return 0;
+// ========================================
+// 五子棋引擎测试
+// 与 bench.cpp 一样直接包含 server.cpp 的引擎部分，用保留下来的原始算法做参照，
+// 检查优化过的实现在随机和构造的局面上结果完全一致
+//
+// 编译：g++ -std=c++17 -O2 -pthread test.cpp -o gobang_test
+// 运行：./gobang_test                 全部通过时退出码为 0
+//       ./gobang_test --filter kernel 只运行名字含 kernel 的用例
+// ========================================
+#define GOBANG_NO_MAIN
+#include "server.cpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+// ========================================
+// 断言与用例注册
+// ========================================
+static int failedChecks = 0;
+
+#define CHECK(cond, ...)                                                              \
+    do                                                                                \
+    {                                                                                 \
+        if (!(cond))                                                                  \
+        {                                                                             \
+            failedChecks++;                                                           \
+            fprintf(stderr, "  %s:%d: 检查失败：%s ", __FILE__, __LINE__, #cond);     \
+            fprintf(stderr, __VA_ARGS__);                                             \
+            fprintf(stderr, "\n");                                                    \
+        }                                                                             \
+    } while (0)
+
+struct TestCase
+{
+    const char *name;
+    void (*run)();
+};
+
+static vector<TestCase> &testCases()
+{
+    static vector<TestCase> cases;
+    return cases;
+}
+
+struct TestRegistrar
+{
+    TestRegistrar(const char *name, void (*run)())
+    {
+        testCases().push_back({name, run});
+    }
+};
+
+#define TEST(name)                                             \
+    static void test_##name();                                 \
+    static TestRegistrar registrar_##name(#name, test_##name); \
+    static void test_##name()
+
+// 棋盘的普通数组表示：0 空、1 黑（玩家）、-1 白（AI），与原 ChessLogic 的 chessMap 相同
+struct PlainBoard
+{
+    int size;
+    int cells[MAX_GRADE_SIZE][MAX_GRADE_SIZE];
+
+    explicit PlainBoard(int size) : size(size)
+    {
+        memset(cells, 0, sizeof(cells));
+    }
+
+    BitBoard toBitBoard() const
+    {
+        BitBoard board;
+        board.clear();
+        for (int r = 0; r < size; r++)
+        {
+            for (int c = 0; c < size; c++)
+            {
+                if (cells[r][c] != 0)
+                    board.set(cells[r][c] == 1 ? 0 : 1, r, c, size);
+            }
+        }
+        return board;
+    }
+};
+
+// 按 density% 的概率随机落子，黑白各半
+static PlainBoard randomBoard(int size, int density, uint64_t &state)
+{
+    PlainBoard board(size);
+    for (int r = 0; r < size; r++)
+    {
+        for (int c = 0; c < size; c++)
+        {
+            uint64_t roll = ZobristKeys::next(state) % 100;
+            if ((int)roll < density)
+                board.cells[r][c] = roll % 2 == 0 ? 1 : -1;
+        }
+    }
+    return board;
+}
+
+// ========================================
+// 评分参照实现 - 原 AILogic::calculateScore() 的逐格扫描，逻辑原样保留，只改为读 PlainBoard
+// PatternTable 和各 ScoreKernel 都必须与它逐格一致
+// ========================================
+static void referenceScore(const PlainBoard &board, int scoreMap[MAX_GRADE_SIZE][MAX_GRADE_SIZE])
+{
+    int personNum = 0;
+    int aiNum = 0;
+    int emptyNum = 0;
+    int size = board.size;
+
+    for (int i = 0; i < size; i++)
+    {
+        for (int j = 0; j < size; j++)
+        {
+            scoreMap[i][j] = 0;
+        }
+    }
+
+    for (int row = 0; row < size; row++)
+    {
+        for (int col = 0; col < size; col++)
+        {
+            if (board.cells[row][col])
+                continue;
+
+            for (int y = -1; y <= 0; y++)
+            {
+                for (int x = -1; x <= 1; x++)
+                {
+                    if (x == 0 && y == 0)
+                        continue;
+                    if (x != 1 && y == 0)
+                        continue;
+
+                    personNum = 0;
+                    aiNum = 0;
+                    emptyNum = 0;
+
+                    // 正向检查玩家（黑棋）
+                    for (int i = 1; i <= 4; i++)
+                    {
+                        int curRow = row + i * y;
+                        int curCol = col + i * x;
+
+                        if (curRow >= 0 && curRow < size && curCol >= 0 && curCol < size &&
+                            board.cells[curRow][curCol] == 1)
+                        {
+                            personNum++;
+                        }
+                        else if (curRow >= 0 && curRow < size && curCol >= 0 && curCol < size &&
+                                 board.cells[curRow][curCol] == 0)
+                        {
+                            emptyNum++;
+                            break;
+                        }
+                        else
+                        {
+                            break;
+                        }
+                    }
+
+                    // 反向检查
+                    for (int i = 1; i <= 4; i++)
+                    {
+                        int curRow = row - i * y;
+                        int curCol = col - i * x;
+
+                        if (curRow >= 0 && curRow < size && curCol >= 0 && curCol < size &&
+                            board.cells[curRow][curCol] == 1)
+                        {
+                            personNum++;
+                        }
+                        else if (curRow >= 0 && curRow < size && curCol >= 0 && curCol < size &&
+                                 board.cells[curRow][curCol] == 0)
+                        {
+                            emptyNum++;
+                            break;
+                        }
+                        else
+                        {
+                            break;
+                        }
+                    }
+
+                    // 玩家威胁评分
+                    if (personNum == 1)
+                    {
+                        scoreMap[row][col] += 10;
+                    }
+                    else if (personNum == 2)
+                    {
+                        if (emptyNum == 1)
+                            scoreMap[row][col] += 30;
+                        else if (emptyNum == 2)
+                            scoreMap[row][col] += 40;
+                    }
+                    else if (personNum == 3)
+                    {
+                        if (emptyNum == 1)
+                            scoreMap[row][col] += 60;
+                        else if (emptyNum == 2)
+                            scoreMap[row][col] += 200;
+                    }
+                    else if (personNum == 4)
+                    {
+                        scoreMap[row][col] += 20000;
+                    }
+
+                    // 检查AI（白棋）
+                    emptyNum = 0;
+
+                    for (int i = 1; i <= 4; i++)
+                    {
+                        int curRow = row + i * y;
+                        int curCol = col + i * x;
+
+                        if (curRow >= 0 && curRow < size && curCol >= 0 && curCol < size &&
+                            board.cells[curRow][curCol] == -1)
+                        {
+                            aiNum++;
+                        }
+                        else if (curRow >= 0 && curRow < size && curCol >= 0 && curCol < size &&
+                                 board.cells[curRow][curCol] == 0)
+                        {
+                            emptyNum++;
+                            break;
+                        }
+                        else
+                        {
+                            break;
+                        }
+                    }
+
+                    for (int i = 1; i <= 4; i++)
+                    {
+                        int curRow = row - i * y;
+                        int curCol = col - i * x;
+
+                        if (curRow >= 0 && curRow < size && curCol >= 0 && curCol < size &&
+                            board.cells[curRow][curCol] == -1)
+                        {
+                            aiNum++;
+                        }
+                        else if (curRow >= 0 && curRow < size && curCol >= 0 && curCol < size &&
+                                 board.cells[curRow][curCol] == 0)
+                        {
+                            emptyNum++;
+                            break;
+                        }
+                        else
+                        {
+                            break;
+                        }
+                    }
+
+                    // AI进攻评分
+                    if (aiNum == 0)
+                    {
+                        scoreMap[row][col] += 5;
+                    }
+                    else if (aiNum == 1)
+                    {
+                        scoreMap[row][col] += 10;
+                    }
+                    else if (aiNum == 2)
+                    {
+                        if (emptyNum == 1)
+                            scoreMap[row][col] += 25;
+                        else if (emptyNum == 2)
+                            scoreMap[row][col] += 50;
+                    }
+                    else if (aiNum == 3)
+                    {
+                        if (emptyNum == 1)
+                            scoreMap[row][col] += 55;
+                        else if (emptyNum == 2)
+                            scoreMap[row][col] += 10000;
+                    }
+                    else if (aiNum == 4)
+                    {
+                        scoreMap[row][col] += 30000;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// 把 board 交给 kind 对应的内核，与参照实现逐格比对；返回不一致的格子数
+template <int N>
+static int compareKernel(ScoreKernel::Kind kind, const PlainBoard &board)
+{
+    int expected[MAX_GRADE_SIZE][MAX_GRADE_SIZE];
+    int actual[MAX_GRADE_SIZE][MAX_GRADE_SIZE];
+    referenceScore(board, expected);
+    ScoreKernel::computeWith<N>(kind, board.toBitBoard(), actual);
+
+    int mismatches = 0;
+    for (int r = 0; r < N; r++)
+    {
+        for (int c = 0; c < N; c++)
+        {
+            if (expected[r][c] != actual[r][c])
+            {
+                if (mismatches == 0)
+                    CHECK(false, "%s 内核 %dx%d (%d,%d)：期望 %d，实际 %d", ScoreKernel::name(kind), N, N, r, c,
+                          expected[r][c], actual[r][c]);
+                mismatches++;
+            }
+        }
+    }
+    return mismatches;
+}
+
+// 随机密度的棋盘，加上只有一种颜色、连子很多的棋盘（容易出现活三、冲四和长连）
+template <int N>
+static void checkKernelsOnRandomBoards(uint64_t seed)
+{
+    const ScoreKernel::Kind kinds[] = {ScoreKernel::KERNEL_SCALAR, ScoreKernel::KERNEL_SSE2,
+                                       ScoreKernel::KERNEL_AVX2};
+    for (ScoreKernel::Kind kind : kinds)
+    {
+        if (!ScoreKernel::supported(kind))
+        {
+            printf("  %s 内核：本机不支持，跳过\n", ScoreKernel::name(kind));
+            continue;
+        }
+        uint64_t state = seed;
+        int badBoards = 0;
+        for (int round = 0; round < 500; round++)
+        {
+            PlainBoard board = randomBoard(N, (int)(ZobristKeys::next(state) % 90), state);
+            if (round % 5 == 0)
+            {
+                // 把一部分棋子改成同一种颜色
+                int color = round % 10 == 0 ? 1 : -1;
+                for (int r = 0; r < N; r++)
+                    for (int c = 0; c < N; c++)
+                        if (board.cells[r][c] != 0 && ZobristKeys::next(state) % 3 != 0)
+                            board.cells[r][c] = color;
+            }
+            if (compareKernel<N>(kind, board) != 0)
+                badBoards++;
+        }
+        CHECK(badBoards == 0, "%s 内核 %dx%d：%d/500 个棋盘不一致", ScoreKernel::name(kind), N, N, badBoards);
+    }
+}
+
+TEST(kernel_matches_reference_13)
+{
+    checkKernelsOnRandomBoards<13>(0x13);
+}
+
+TEST(kernel_matches_reference_15)
+{
+    checkKernelsOnRandomBoards<15>(0x15);
+}
+
+TEST(kernel_matches_reference_19)
+{
+    checkKernelsOnRandomBoards<19>(0x19);
+}
+
+// 空棋盘和下满的棋盘是两个极端：前者全是 5 分基准，后者全为 0
+TEST(kernel_empty_and_full_boards)
+{
+    const ScoreKernel::Kind kinds[] = {ScoreKernel::KERNEL_SCALAR, ScoreKernel::KERNEL_SSE2,
+                                       ScoreKernel::KERNEL_AVX2};
+    for (ScoreKernel::Kind kind : kinds)
+    {
+        if (!ScoreKernel::supported(kind))
+            continue;
+        PlainBoard empty(19);
+        compareKernel<19>(kind, empty);
+        uint64_t state = 7;
+        PlainBoard full = randomBoard(13, 100, state);
+        compareKernel<13>(kind, full);
+    }
+}
+
+// ========================================
+// 贪心应手回放 - test_greedy_games.txt 记录了 300 局脚本对局（玩家随机落子，AI 用 think() 应手），
+// 由引入 PatternTable 之前的逐格扫描评分生成。每个 AI 回合记下了当时所有最高分的点，
+// 现在的 think() 选出的点必须在其中（最高分有并列时随机取一个，所以不比较具体选了哪个）
+// ========================================
+struct ReplayMove
+{
+    bool ai;
+    ChessPos pos;
+    vector<ChessPos> best; // 仅 AI 回合：所有最高分的点
+};
+
+static bool parsePos(const string &text, ChessPos &pos)
+{
+    return sscanf(text.c_str(), "%d,%d", &pos.row, &pos.col) == 2;
+}
+
+// 一局一行：G<编号> B<r>,<c> W<r>,<c>=<r>,<c>/<r>,<c>/...
+static bool parseReplayLine(const string &line, int &game, vector<ReplayMove> &moves)
+{
+    istringstream in(line);
+    string token;
+    if (!(in >> token) || token[0] != 'G')
+        return false;
+    game = atoi(token.c_str() + 1);
+    moves.clear();
+    while (in >> token)
+    {
+        ReplayMove move;
+        move.ai = token[0] == 'W';
+        size_t eq = token.find('=');
+        if (!parsePos(token.substr(1, eq == string::npos ? string::npos : eq - 1), move.pos))
+            return false;
+        if (move.ai)
+        {
+            if (eq == string::npos)
+                return false;
+            stringstream list(token.substr(eq + 1));
+            string item;
+            while (getline(list, item, '/'))
+            {
+                ChessPos pos;
+                if (!parsePos(item, pos))
+                    return false;
+                move.best.push_back(pos);
+            }
+        }
+        moves.push_back(move);
+    }
+    return true;
+}
+
+TEST(greedy_replay_matches_original_scoring)
+{
+    ifstream file("test_greedy_games.txt");
+    if (!file)
+    {
+        CHECK(false, "打不开 test_greedy_games.txt，请在仓库目录下运行");
+        return;
+    }
+
+    int games = 0;
+    int aiTurns = 0;
+    string line;
+    while (getline(file, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        int game;
+        vector<ReplayMove> moves;
+        if (!parseReplayLine(line, game, moves))
+        {
+            CHECK(false, "无法解析：%s", line.c_str());
+            continue;
+        }
+        games++;
+
+        ChessLogic<13> chess;
+        AILogic<13> ai;
+        chess.init();
+        ai.init(&chess);
+        ai.seed((uint64_t)game);
+        for (size_t i = 0; i < moves.size(); i++)
+        {
+            const ReplayMove &move = moves[i];
+            if (move.ai)
+            {
+                aiTurns++;
+                ChessPos chosen = ai.think();
+                bool found = false;
+                for (const ChessPos &pos : move.best)
+                    found = found || (pos.row == chosen.row && pos.col == chosen.col);
+                CHECK(found, "第 %d 局第 %zu 步：think() 选了 (%d,%d)，不在原来的最高分点里", game, i, chosen.row,
+                      chosen.col);
+                if (!found)
+                    break;
+            }
+            // 按记录的落子继续，和生成时走的是同一盘棋
+            bool placed = chess.chessDown(move.pos.row, move.pos.col, move.ai ? CHESS_WHITE : CHESS_BLACK);
+            CHECK(placed, "第 %d 局第 %zu 步 (%d,%d) 落不下去", game, i, move.pos.row, move.pos.col);
+            if (!placed)
+                break;
+        }
+    }
+    CHECK(games == 300, "应有 300 局，实际读到 %d 局", games);
+    printf("  %d 局，%d 个 AI 回合\n", games, aiTurns);
+}
+
+// ========================================
+// 胜负判定 - ChessLogic::checkWin / isWinningMove 与原 checkWin() 的逐格数子比对
+// 原算法沿四个方向数同色连子，>= 5 即胜，所以长连（六连及以上）也算赢
+// ========================================
+static bool referenceWinAt(const PlainBoard &board, int row, int col)
+{
+    static const int directions[4][2] = {{0, 1}, {1, 0}, {1, 1}, {1, -1}};
+    int playerChess = board.cells[row][col];
+    if (playerChess == 0)
+        return false;
+    for (const auto &d : directions)
+    {
+        int count = 1;
+        for (int i = 1; i < 5; i++)
+        {
+            int r = row - i * d[0], c = col - i * d[1];
+            if (r < 0 || r >= board.size || c < 0 || c >= board.size || board.cells[r][c] != playerChess)
+                break;
+            count++;
+        }
+        for (int i = 1; i < 5; i++)
+        {
+            int r = row + i * d[0], c = col + i * d[1];
+            if (r < 0 || r >= board.size || c < 0 || c >= board.size || board.cells[r][c] != playerChess)
+                break;
+            count++;
+        }
+        if (count >= 5)
+            return true;
+    }
+    return false;
+}
+
+// 依次落下 black 里的黑子，之间用 fillers 里的白子补齐轮次（chessDown 总是黑白交替）；
+// 最后一手是 black 的最后一个点
+template <int N>
+static bool playBlackStones(ChessLogic<N> &chess, const vector<ChessPos> &black, const vector<ChessPos> &fillers)
+{
+    chess.init();
+    for (size_t i = 0; i < black.size(); i++)
+    {
+        if (!chess.chessDown(black[i].row, black[i].col, CHESS_BLACK))
+            return false;
+        if (i + 1 < black.size() && !chess.chessDown(fillers[i].row, fillers[i].col, CHESS_WHITE))
+            return false;
+    }
+    return true;
+}
+
+// 不在 stones 里、也不与它们同线相邻的白子，够 count 个为止
+static vector<ChessPos> fillersAvoiding(int size, const vector<ChessPos> &stones, int count)
+{
+    vector<ChessPos> fillers;
+    for (int r = size - 1; r >= 0 && (int)fillers.size() < count; r--)
+    {
+        for (int c = 0; c < size && (int)fillers.size() < count; c++)
+        {
+            bool near = false;
+            for (const ChessPos &s : stones)
+                near = near || (abs(s.row - r) <= 1 && abs(s.col - c) <= 1);
+            if (!near)
+                fillers.push_back(ChessPos(r, c));
+        }
+    }
+    return fillers;
+}
+
+// 每个方向、每个能放下五连的起点（含贴边和四个角），依次把五个点中的每一个作为最后一手
+template <int N>
+static void checkEveryFive()
+{
+    static const int directions[4][2] = {{0, 1}, {1, 0}, {1, 1}, {1, -1}};
+    ChessLogic<N> chess;
+    int lines = 0;
+    for (const auto &d : directions)
+    {
+        for (int row = 0; row < N; row++)
+        {
+            for (int col = 0; col < N; col++)
+            {
+                int endRow = row + 4 * d[0], endCol = col + 4 * d[1];
+                if (endRow < 0 || endRow >= N || endCol < 0 || endCol >= N)
+                    continue;
+                vector<ChessPos> five;
+                for (int i = 0; i < 5; i++)
+                    five.push_back(ChessPos(row + i * d[0], col + i * d[1]));
+                vector<ChessPos> fillers = fillersAvoiding(N, five, 4);
+                lines++;
+
+                for (int last = 0; last < 5; last++)
+                {
+                    vector<ChessPos> order = five;
+                    swap(order[last], order[4]);
+
+                    // 前四子：还没赢，第五个点对黑棋是一步胜、对白棋不是
+                    vector<ChessPos> four(order.begin(), order.begin() + 4);
+                    CHECK(playBlackStones(chess, four, fillers), "%dx%d 落子失败", N, N);
+                    CHECK(!chess.checkWin(), "%dx%d 四子 (%d,%d) 方向 (%d,%d) 被判为胜", N, N, row, col, d[0], d[1]);
+                    CHECK(chess.isWinningMove(CHESS_BLACK, order[4].row, order[4].col),
+                          "%dx%d (%d,%d) 方向 (%d,%d) 缺 (%d,%d) 时不是一步胜", N, N, row, col, d[0], d[1],
+                          order[4].row, order[4].col);
+                    CHECK(!chess.isWinningMove(CHESS_WHITE, order[4].row, order[4].col),
+                          "%dx%d 白棋在 (%d,%d) 被判为一步胜", N, N, order[4].row, order[4].col);
+
+                    CHECK(playBlackStones(chess, order, fillers), "%dx%d 落子失败", N, N);
+                    CHECK(chess.checkWin(), "%dx%d 五连 (%d,%d) 方向 (%d,%d) 最后一手 (%d,%d) 未判胜", N, N, row,
+                          col, d[0], d[1], order[4].row, order[4].col);
+                }
+            }
+        }
+    }
+    // 每个方向能放下五连的起点数：横竖各 N*(N-4)，两条斜线各 (N-4)^2
+    CHECK(lines == 2 * N * (N - 4) + 2 * (N - 4) * (N - 4), "%dx%d 只检查了 %d 条五连", N, N, lines);
+}
+
+TEST(check_win_every_five_13)
+{
+    checkEveryFive<13>();
+}
+
+TEST(check_win_every_five_15)
+{
+    checkEveryFive<15>();
+}
+
+TEST(check_win_every_five_19)
+{
+    checkEveryFive<19>();
+}
+
+// 长连、被对方棋子截断的五连，以及贴边时不能跨到下一行/下一条斜线
+TEST(check_win_overlines_and_breaks)
+{
+    ChessLogic<19> chess;
+
+    // 六连：最后一手在中间或一端都算赢
+    vector<ChessPos> six = {ChessPos(9, 3), ChessPos(9, 4), ChessPos(9, 6), ChessPos(9, 7), ChessPos(9, 8),
+                            ChessPos(9, 5)};
+    CHECK(playBlackStones(chess, six, fillersAvoiding(19, six, 5)) && chess.checkWin(), "六连未判胜");
+    vector<ChessPos> sixEnd = {ChessPos(0, 0), ChessPos(1, 1), ChessPos(2, 2), ChessPos(3, 3), ChessPos(5, 5),
+                               ChessPos(4, 4)};
+    CHECK(playBlackStones(chess, sixEnd, fillersAvoiding(19, sixEnd, 5)) && chess.checkWin(), "角上斜六连未判胜");
+    vector<ChessPos> nine = {ChessPos(18, 0), ChessPos(17, 1), ChessPos(16, 2), ChessPos(15, 3),
+                             ChessPos(13, 5), ChessPos(12, 6), ChessPos(11, 7), ChessPos(10, 8),
+                             ChessPos(14, 4)};
+    CHECK(playBlackStones(chess, nine, fillersAvoiding(19, nine, 8)) && chess.checkWin(), "反斜九连未判胜");
+
+    // 中间隔一个白子的两段四连不算
+    chess.init();
+    int moves[][2] = {{5, 0}, {5, 4}, {5, 1}, {0, 18}, {5, 2}, {18, 18}, {5, 3}, {18, 0}, {5, 5}, {0, 0},
+                      {5, 6}, {10, 18}, {5, 7}, {18, 10}, {5, 8}};
+    for (auto &m : moves)
+        chess.chessDown(m[0], m[1], CHESS_BLACK);
+    CHECK(!chess.checkWin(), "被白子截断的两段四连被判为胜");
+
+    // 行尾两子接下一行行首三子：位平面按行分开，不能连起来
+    vector<ChessPos> wrap = {ChessPos(4, 17), ChessPos(4, 18), ChessPos(5, 0), ChessPos(5, 1), ChessPos(5, 2)};
+    CHECK(playBlackStones(chess, wrap, fillersAvoiding(19, wrap, 4)) && !chess.checkWin(), "跨行的五子被判为胜");
+
+    // 相邻两条斜线上的子不能连起来
+    vector<ChessPos> split = {ChessPos(0, 1), ChessPos(1, 2), ChessPos(2, 3), ChessPos(4, 4), ChessPos(5, 5)};
+    CHECK(playBlackStones(chess, split, fillersAvoiding(19, split, 4)) && !chess.checkWin(), "两条斜线上的五子被判为胜");
+}
+
+// 19 路随机对局：每一手之后 checkWin 与原算法一致，随机空位上的 isWinningMove 也一致
+TEST(check_win_matches_reference_random_19)
+{
+    uint64_t state = 0x12;
+    int games = 0, wins = 0;
+    for (; games < 300; games++)
+    {
+        ChessLogic<19> chess;
+        chess.init();
+        PlainBoard board(19);
+        chess_kind side = CHESS_BLACK;
+        for (int move = 0; move < 19 * 19; move++)
+        {
+            int row, col;
+            do
+            {
+                row = (int)(ZobristKeys::next(state) % 19);
+                col = (int)(ZobristKeys::next(state) % 19);
+            } while (board.cells[row][col] != 0);
+
+            for (int probe = 0; probe < 4; probe++)
+            {
+                int r = (int)(ZobristKeys::next(state) % 19), c = (int)(ZobristKeys::next(state) % 19);
+                if (board.cells[r][c] != 0)
+                    continue;
+                for (chess_kind kind : {CHESS_BLACK, CHESS_WHITE})
+                {
+                    board.cells[r][c] = kind;
+                    bool expected = referenceWinAt(board, r, c);
+                    board.cells[r][c] = 0;
+                    CHECK(chess.isWinningMove(kind, r, c) == expected, "第 %d 局 (%d,%d) isWinningMove 与原算法不一致",
+                          games, r, c);
+                }
+            }
+
+            chess.chessDown(row, col, side);
+            board.cells[row][col] = side;
+            bool expected = referenceWinAt(board, row, col);
+            CHECK(chess.checkWin() == expected, "第 %d 局第 %d 手 (%d,%d) checkWin 与原算法不一致", games, move, row,
+                  col);
+            if (expected)
+            {
+                wins++;
+                break;
+            }
+            side = side == CHESS_BLACK ? CHESS_WHITE : CHESS_BLACK;
+        }
+    }
+    CHECK(wins > 0, "随机对局没有一局分出胜负");
+}
+
+// ========================================
+// 置换表 - 各字段全为 0 的条目（0 分、0 深度、精确值、着法 (0,0)、第 0 代）也必须能取回
+// ========================================
+TEST(transposition_table_keeps_all_zero_entry)
+{
+    TranspositionTable table;
+    table.resize(1);
+    const uint64_t key = 0x123456789ULL;
+    TTEntry entry{};
+    CHECK(!table.probe(key, entry), "空表里查到了条目");
+
+    table.store(key, 0, 0, TT_EXACT, ChessPos(0, 0));
+    bool found = table.probe(key, entry);
+    CHECK(found, "全 0 的条目存入后查不到");
+    CHECK(found && entry.score == 0 && entry.depth == 0 && entry.flag == TT_EXACT && entry.move.row == 0 &&
+              entry.move.col == 0,
+          "取回的条目与存入的不同");
+
+    // 负分和无着法也要原样取回
+    table.store(key, -30000, 7, TT_UPPER, ChessPos(-1, -1));
+    found = table.probe(key, entry);
+    CHECK(found && entry.score == -30000 && entry.depth == 7 && entry.flag == TT_UPPER && entry.move.row == -1,
+          "负分条目取回不一致");
+
+    table.clear();
+    CHECK(!table.probe(key, entry), "clear() 之后仍查到条目");
+}
+
+// ========================================
+// 主程序
+// ========================================
+int main(int argc, char **argv)
+{
+    const char *filter = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            filter = argv[++i];
+    }
+
+    int ran = 0;
+    int failedCases = 0;
+    for (const TestCase &test : testCases())
+    {
+        if (filter != nullptr && strstr(test.name, filter) == nullptr)
+            continue;
+        int before = failedChecks;
+        auto start = chrono::steady_clock::now();
+        test.run();
+        long long ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+        bool ok = failedChecks == before;
+        printf("[%s] %s (%lld ms)\n", ok ? "通过" : "失败", test.name, ms);
+        ran++;
+        if (!ok)
+            failedCases++;
+    }
+
+    printf("%d 个用例，%d 个失败\n", ran, failedCases);
+    return failedCases == 0 ? 0 : 1;
 }